@@ -0,0 +1,30 @@
+/*
+ * CpuFeatures.h
+ *
+ * Instruction set of the vectorized kernels, chosen at run time: the binary
+ * is built for the baseline ISA and every kernel variant is compiled for its
+ * own target, the best one the CPU reports (CPUID) is called. TLD_ISA in the
+ * environment (scalar, sse2, sse4.1, avx2, avx512, read when the first TLD is
+ * created) or setCpuIsa() lowers it, to compare kernels on one machine.
+ */
+#pragma once
+
+enum CpuIsa {
+  ISA_SCALAR = 0,
+  ISA_SSE2,
+  ISA_SSE41,
+  ISA_AVX2,
+  ISA_AVX512,   //AVX-512F and BW
+  ISA_NUM
+};
+
+//Best instruction set of this CPU, ISA_SCALAR outside x86
+int cpuIsaDetected();
+//Instruction set the kernels use
+int cpuIsa();
+//Use isa (at most the detected one), false if the CPU lacks it. Also turns
+//OpenCV's own SIMD paths off for ISA_SCALAR. Not meant to change while frames are processed.
+bool setCpuIsa(int isa);
+//By name, false for an unknown or unsupported one
+bool setCpuIsa(const char* name);
+const char* cpuIsaName(int isa);
@@ -0,0 +1,37 @@
+/*
+ * DetectionClusterer.h
+ *
+ * Groups the detections of one frame. Two detections belong to the same
+ * cluster when their overlap is at least 0.5, clusters are the connected
+ * components of that relation (what cv::partition computed with bbcomp).
+ * Detections are swept in x order so only horizontally overlapping pairs
+ * are compared, and the scratch buffers are kept between frames.
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <WindowGrid.h>
+#include <vector>
+
+class DetectionClusterer{
+public:
+  DetectionClusterer():nms(false),threshold(0.5f){}
+  //cluster_nms: 1 selects confidence-weighted NMS instead of clustering
+  void read(const cv::FileNode& file);
+  void setNMS(bool on){nms=on;}
+  //Labels numbered by first detection like cv::partition, returns the number of clusters
+  int partition(const std::vector<BoundingBox>& dbb,std::vector<int>& labels);
+  //Mean box and confidence of every cluster (or NMS group)
+  void cluster(const std::vector<BoundingBox>& dbb,const std::vector<float>& dconf,
+      std::vector<BoundingBox>& cbb,std::vector<float>& cconf);
+private:
+  //Most confident remaining detection absorbs the ones overlapping it,
+  //the group box is the confidence-weighted mean
+  void suppress(const std::vector<BoundingBox>& dbb,const std::vector<float>& dconf,
+      std::vector<BoundingBox>& cbb,std::vector<float>& cconf);
+  int find(int i);
+  bool nms;
+  float threshold;
+  std::vector<int> order;
+  std::vector<int> parent;
+  std::vector<int> labels;
+};
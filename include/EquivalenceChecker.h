@@ -0,0 +1,79 @@
+/*
+ * EquivalenceChecker.h
+ *
+ * Shadow execution of the detector and tracker stages. Attached to a TLD,
+ * every stage result of a frame is recomputed with the plain scalar
+ * implementation (variance from the pixels, one fern feature at a time,
+ * NN correlation in double against float examples, a fresh LK tracker, the
+ * blur and detection pyramid of the whole frame) on the same inputs and
+ * model state, and the differences are accumulated: windows whose decision
+ * flips, fern codes that differ, confidence and box deltas. The fast paths
+ * selected by the parameters (tiled scan, int8 NN, ...) can then be changed
+ * without drifting silently.
+ * With nn_quantized the reference correlates against the dequantized
+ * examples, the model itself only holds the int8 ones.
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <LKTracker.h>
+#include <JsonWriter.h>
+#include <WindowGrid.h>
+#include <stdint.h>
+#include <vector>
+
+class TLD;
+
+enum CheckStage {
+  CHECK_VARIANCE = 0,   //per window: variance >= var
+  CHECK_FERNS,          //per window passing variance: codes, confidence, > fern threshold
+  CHECK_NN,             //per fern candidate: conf1, conf2, conf1 > thr_nn
+  CHECK_TRACK,          //per tracked frame: tracked or not, points, predicted box
+  CHECK_NUM_STAGES
+};
+
+const char* checkStageName(int stage);
+
+struct StageDivergence {
+  int64_t checked;      //windows, candidates or frames compared
+  int64_t decisions;    //of which the pass/fail decision differs
+  int64_t mismatches;   //of which the stage output differs (codes, point count, box)
+  double max_delta;     //largest confidence (variance, points: pixels) difference
+  double sum_delta;
+  int first_frame;      //first frame with a differing decision or output, -1: none
+};
+
+class EquivalenceChecker{
+public:
+  EquivalenceChecker();
+  void reset();
+  //Adds the counts of another checker (totals over sequences, first_frame is not merged)
+  void merge(const EquivalenceChecker& other);
+  //Frame number reported for the following checks
+  void setFrame(int f){frame=f;}
+  const StageDivergence& stage(int s) const {return stages[s];}
+  //Decisions or outputs differ in some stage
+  bool diverged() const;
+  void writeJson(JsonWriter& json) const;
+
+  //Called by TLD::detect() after the cascade and after NN verification,
+  //and by TLD::track()
+  void checkCascade(TLD& tld,const cv::Mat& frame,const cv::Rect& roi,const cv::Range& scales);
+  void checkNN(TLD& tld);
+  //The reference tracks the same frames (a level crop with track_min_side,
+  //f frame pixels per pixel from offset) from the same start points and
+  //lk_motion seed (empty: cold start); tracked1/2 are in frame coordinates
+  void checkTrack(TLD& tld,const cv::Mat& img1,const cv::Mat& img2,float f,const cv::Point2f& offset,
+      const std::vector<cv::Point2f>& start,const std::vector<cv::Point2f>& seed,float residual,
+      const std::vector<cv::Point2f>& tracked1,const std::vector<cv::Point2f>& tracked2,bool tracked);
+private:
+  //Reference implementations
+  static double refVar(const cv::Mat& frame,const cv::Rect& box);
+  static void refFeatures(TLD& tld,const std::vector<cv::Mat>& pyr,const BoundingBox& w,std::vector<int>& code);
+  static float refForest(TLD& tld,const std::vector<int>& code);
+  static double refNCC(const cv::Mat& a,const cv::Mat& b);
+  static void refNNConf(TLD& tld,const cv::Mat& pattern,float& rsconf,float& csconf);
+  void add(int s,bool decision,bool mismatch,double delta);
+  StageDivergence stages[CHECK_NUM_STAGES];
+  int frame;
+  LKTracker tracker;
+};
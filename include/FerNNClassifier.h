@@ -7,6 +7,11 @@
 
 #include <opencv2/opencv.hpp>
 #include <stdio.h>
+#include <memory>
+#include <atomic>
+#include <ModelFile.h>
+#include <QuantizedNN.h>
+#include <FernTrainingSet.h>
 class FerNNClassifier{
 private:
   float thr_fern;
@@ -16,24 +21,48 @@ private:
   float ncc_thesame;
   float thr_nn;
   int acum;
+  bool quantized;
 public:
+  FerNNClassifier();
   //Parameters
   float thr_nn_valid;
+  std::atomic<int64_t> nn_comparisons; //patch comparisons made by NNConf so far (NNConf may run on two threads)
 
   void read(const cv::FileNode& file);
   void prepare(const std::vector<cv::Size>& scales);
   void getFeatures(const cv::Mat& image,const int& scale_idx,std::vector<int>& fern);
-  void update(const std::vector<int>& fern, int C, int N);
-  float measure_forest(std::vector<int> fern);
-  void trainF(const std::vector<std::pair<std::vector<int>,int> >& ferns,int resample);
+  //Pyramid level each scale is coded at (pyramid_detect), empty: all at full
+  //resolution. Derives level_features, call again after prepare or loadState
+  void setLevels(const std::vector<int>& scale_levels);
+  int getLevel(int scale_idx) const {return levels.empty() ? 0 : levels[scale_idx];}
+  int maxLevel() const;
+  //getFeatures on the window's pixels at the scale's level
+  void getLevelFeatures(const cv::Mat& image,const int& scale_idx,std::vector<int>& fern);
+  void update(const int* fern, int C, int N);
+  void update(const std::vector<int>& fern, int C, int N){update(&fern[0],C,N);}
+  float measure_forest(const int* fern);
+  float measure_forest(const std::vector<int>& fern){return measure_forest(&fern[0]);}
+  void trainF(const FernTrainingSet& ferns,int resample);
   void trainNN(const std::vector<cv::Mat>& nn_examples);
   void NNConf(const cv::Mat& example,std::vector<int>& isin,float& rsconf,float& csconf);
-  void evaluateTh(const std::vector<std::pair<std::vector<int>,int> >& nXT,const std::vector<cv::Mat>& nExT);
+  //int8 NN examples (nn_quantized: 1), converts the examples already stored
+  void setQuantized(bool q);
+  bool isQuantized() const {return quantized;}
+  int numPositive() const {return quantized ? pQ.size() : pEx.size();}
+  int numNegative() const {return quantized ? nQ.size() : nEx.size();}
+  //Positive example i as a float patch, whatever the storage
+  cv::Mat positive(int i) const {return quantized ? pQ.toFloat(i,patch_side) : pEx[i];}
+  cv::Mat negative(int i) const {return quantized ? nQ.toFloat(i,patch_side) : nEx[i];}
+  void evaluateTh(const FernTrainingSet& nXT,const std::vector<cv::Mat>& nExT);
   void show();
+  //Model snapshots
+  void saveState(ModelHeader& header,ModelWriter& writer);
+  bool loadState(const ModelHeader& header,const std::shared_ptr<MappedFile>& file);
   //Ferns Members
   int getNumStructs(){return nstructs;}
   float getFernTh(){return thr_fern;}
   float getNNTh(){return thr_nn;}
+  float getValid(){return valid;}
   struct Feature
       {
           uchar x1, y1, x2, y2;
@@ -45,6 +74,7 @@ public:
           { return patch.at<uchar>(y1,x1) > patch.at<uchar>(y2, x2); }
       };
   std::vector<std::vector<Feature> > features; //Ferns features (one std::vector for each scale)
+  std::vector<std::vector<Feature> > level_features; //features of each scale at its pyramid level
   std::vector< std::vector<int> > nCounter; //negative counter
   std::vector< std::vector<int> > pCounter; //positive counter
   std::vector< std::vector<float> > posteriors; //Ferns posteriors
@@ -53,4 +83,10 @@ public:
   //NN Members
   std::vector<cv::Mat> pEx; //NN positive examples
   std::vector<cv::Mat> nEx; //NN negative examples
+  QuantizedPatches pQ;      //NN positive examples in quantized mode
+  QuantizedPatches nQ;      //NN negative examples in quantized mode
+private:
+  int patch_side;           //side of the NN patches seen so far
+  std::vector<int> levels;  //pyramid level of each scale
+  std::shared_ptr<MappedFile> model_file; //backs examples loaded from a snapshot
 };
@@ -0,0 +1,33 @@
+/*
+ * FernTrainingSet.h
+ *
+ * Labelled fern codes for FerNNClassifier::trainF. The codes (num_trees
+ * leaves each) are stored back to back in one array, one per sample,
+ * instead of one heap-allocated vector per sample.
+ */
+#pragma once
+#include <stddef.h>
+#include <vector>
+
+class FernTrainingSet{
+public:
+  FernTrainingSet():trees(0){}
+  //Empties the set for codes of num_trees leaves
+  void reset(int num_trees);
+  //Sample with label (1: positive, 0: negative)
+  void add(const int* code,int label);
+  void add(const std::vector<int>& code,int label){add(&code[0],label);}
+  //Samples of other added to this one
+  void append(const FernTrainingSet& other);
+  //Random order of the samples (rand())
+  void shuffle();
+  int numTrees() const {return trees;}
+  int size() const {return labels.size();}
+  bool empty() const {return labels.empty();}
+  const int* code(int i) const {return &codes[(size_t)i*trees];}
+  int label(int i) const {return labels[i];}
+private:
+  int trees;
+  std::vector<int> codes;
+  std::vector<int> labels;
+};
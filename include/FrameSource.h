@@ -0,0 +1,76 @@
+/*
+ * FrameSource.h
+ *
+ * Gray frames from a camera or a video file. Video files can be backed by a
+ * frame cache: the first complete pass writes the decoded gray frames to a
+ * raw file (FrameCacheHeader, frames, frame index), later passes and later
+ * runs map that file and hand out frames without decoding or copying.
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ModelFile.h>
+
+const char FRAME_CACHE_MAGIC[8] = {'T','L','D','F','R','A','M','E'};
+const uint32_t FRAME_CACHE_VERSION = 1;
+
+struct FrameCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;
+  uint32_t header_size;
+  int32_t width, height;
+  uint32_t step;           //bytes per row
+  uint32_t num_frames;
+  uint64_t source_size;    //the cache is rebuilt when the video changes
+  int64_t source_mtime;
+  ModelSection index;      //num_frames uint64 frame offsets
+};
+
+class FrameSource{
+public:
+  FrameSource();
+  ~FrameSource();
+  //Video file, cached in cache_path when given
+  bool open(const std::string& video,const std::string& cache_path="");
+  //Camera
+  bool open(int device);
+  bool isOpened() const;
+  bool set(int prop,double value);
+  //Next frame. gray must not be modified and stays valid until the
+  //next-but-one read(); color (for display) is optional.
+  bool read(cv::Mat& gray,cv::Mat* color=NULL);
+  //Back to the first frame, switches to the cache if it has been completed
+  bool rewind();
+  bool fromCache() const {return mapped!=NULL;}
+  int frameCount() const {return mapped ? (int)frames.size() : -1;}
+private:
+  FrameSource(const FrameSource&);
+  FrameSource& operator=(const FrameSource&);
+  bool openCache();
+  void startCache(const cv::Mat& gray);
+  void appendCache(const cv::Mat& gray);
+  void finishCache();
+  void abortCache();
+  void close();
+  std::string video;
+  std::string cache_path;
+  cv::VideoCapture capture;
+  cv::Mat color_frame;
+  cv::Mat gray_buffers[2];
+  int current;
+  //Reading from the cache
+  MappedFile* mapped;
+  const FrameCacheHeader* header;
+  std::vector<cv::Mat> frames;
+  int next;
+  //Writing the cache
+  FILE* writing;
+  uint64_t write_pos;
+  std::vector<uint64_t> offsets;
+  cv::Size write_size;
+  bool write_failed;
+};
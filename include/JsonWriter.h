@@ -0,0 +1,34 @@
+/*
+ * JsonWriter.h
+ *
+ * Minimal streaming JSON writer for the benchmark reports.
+ */
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class JsonWriter{
+public:
+  explicit JsonWriter(FILE* file);
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  //Member name, followed by a value, an object or an array
+  JsonWriter& key(const std::string& name);
+  void value(double v);
+  void value(int v);
+  void value(bool v);
+  void value(const std::string& v);
+  void value(const char* v){value(std::string(v));}
+  //Shorthands for key(name).value(v)
+  template <class T> void member(const std::string& name,const T& v){key(name); value(v);}
+private:
+  void separate();
+  void indent();
+  void writeString(const std::string& s);
+  FILE* file;
+  std::vector<bool> first;   //per open container: nothing written yet
+  bool after_key;
+};
@@ -1,5 +1,7 @@
+#pragma once
 #include<tld_utils.h>
 #include <opencv2/opencv.hpp>
+#include <Profiler.h>
 
 
 class LKTracker{
@@ -15,12 +17,24 @@ private:
   float fbmed;
   cv::TermCriteria term_criteria;
   float lambda;
+  Profiler* prof;
+  std::vector<cv::Point2f> guess;
+  bool track(const cv::Mat& img1,const cv::Mat& img2,std::vector<cv::Point2f>& points1,std::vector<cv::Point2f>& points2,
+             int levels,const cv::TermCriteria& term,int flags);
   void normCrossCorrelation(const cv::Mat& img1,const cv::Mat& img2, std::vector<cv::Point2f>& points1, std::vector<cv::Point2f>& points2);
   bool filterPts(std::vector<cv::Point2f>& points1,std::vector<cv::Point2f>& points2);
 public:
   LKTracker();
   bool trackf2f(const cv::Mat& img1, const cv::Mat& img2,
                 std::vector<cv::Point2f> &points1, std::vector<cv::Point2f> &points2);
+  //Starts from the positions in points2, expected within residual pixels of
+  //the actual ones: fewer pyramid levels and iterations than a cold start
+  bool trackf2f(const cv::Mat& img1, const cv::Mat& img2,
+                std::vector<cv::Point2f> &points1, std::vector<cv::Point2f> &points2,float residual);
+  //Pyramid levels a start residual pixels away needs
+  int levelsFor(float residual) const;
   float getFB(){return fbmed;}
+  //Stage timers of the owner, not owned
+  void setProfiler(Profiler* p){prof=p;}
 };
 
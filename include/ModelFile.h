@@ -0,0 +1,104 @@
+/*
+ * ModelFile.h
+ *
+ * Binary snapshot of a trained TLD model.
+ * Layout: a fixed ModelHeader followed by raw arrays (sections), each one
+ * starting on a MODEL_ALIGN boundary. Arrays are stored in the in-memory
+ * representation of the host, so a mapped file is usable as is: loading is
+ * a header check plus memcpy of the mutable tables, NN examples point
+ * straight into the mapping.
+ */
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+
+const char MODEL_MAGIC[8] = {'T','L','D','M','O','D','E','L'};
+const uint32_t MODEL_VERSION = 3;
+const uint32_t MODEL_ENDIAN = 0x01020304;
+const uint64_t MODEL_ALIGN = 64;
+
+struct ModelSection {
+  uint64_t offset;  //from the beginning of the file
+  uint64_t bytes;
+};
+
+struct ModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;
+  uint32_t header_size;
+  //Grid (rebuilt on load from the box and frame size)
+  int32_t frame_width, frame_height;
+  int32_t box_width, box_height;
+  int32_t min_win;
+  int32_t num_scales;
+  ModelSection scales;      //num_scales x {int32 width, int32 height}
+  //Last known object state
+  int32_t lastbox[4];       //x,y,width,height
+  float lastconf;
+  int32_t lastvalid;
+  float var;                //variance threshold
+  //Fern classifier
+  int32_t num_trees;
+  int32_t num_features;
+  int32_t acum;
+  float thr_fern, thr_nn, thr_nn_valid;
+  float thrN, thrP;
+  float valid, ncc_thesame;
+  ModelSection features;    //num_scales x num_trees*num_features FerNNClassifier::Feature
+  ModelSection posteriors;  //num_trees x 2^num_features float
+  ModelSection pcounter;    //num_trees x 2^num_features int32
+  ModelSection ncounter;    //num_trees x 2^num_features int32
+  //Nearest neighbour classifier
+  int32_t patch_size;
+  int32_t num_pex, num_nex;
+  ModelSection pattern;     //last positive pattern (TLD::pEx), patch_size^2 float
+  ModelSection pex;         //num_pex patch_size^2 float patches (empty if quantized)
+  ModelSection nex;         //num_nex patch_size^2 float patches (empty if quantized)
+  //Quantized NN examples (QuantizedNN.h), version 2
+  int32_t nn_quantized;     //examples are in the sections below instead of pex/nex
+  int32_t nn_stride;        //bytes per quantized patch
+  ModelSection pex_q;       //num_pex x nn_stride int8
+  ModelSection pex_qinfo;   //num_pex float scales, then num_pex float norms
+  ModelSection nex_q;       //num_nex x nn_stride int8
+  ModelSection nex_qinfo;   //num_nex float scales, then num_nex float norms
+};
+
+//Writes sections after a header placeholder, the header goes in last
+class ModelWriter{
+public:
+  ModelWriter():file(NULL),pos(0),failed(false){}
+  ~ModelWriter();
+  bool open(const std::string& path);
+  //Appends an aligned section
+  ModelSection append(const void* data,uint64_t bytes);
+  //Writes the final header and closes the file, false on any write error
+  bool finish(ModelHeader& header);
+private:
+  FILE* file;
+  uint64_t pos;
+  bool failed;
+};
+
+//Read-only private mapping of a model file
+class MappedFile{
+public:
+  MappedFile():addr(NULL),len(0){}
+  ~MappedFile();
+  bool open(const std::string& path);
+  const char* data() const {return (const char*)addr;}
+  uint64_t size() const {return len;}
+  //Checks that the section lies inside the file and has the expected size
+  bool contains(const ModelSection& s,uint64_t bytes) const;
+  const void* section(const ModelSection& s) const {return data()+s.offset;}
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+  void* addr;
+  uint64_t len;
+};
+
+//Validates magic, version, endianness and header size of a mapped model
+bool checkModelHeader(const MappedFile& file,const ModelHeader*& header);
+void initModelHeader(ModelHeader& header);
@@ -0,0 +1,34 @@
+/*
+ * MotionModel.h
+ *
+ * Constant velocity prediction of the object's box from frame to frame:
+ * center velocity and scale change per frame, smoothed over the tracked
+ * frames, with a running mean of how far the predictions were off. The
+ * tracker starts Lucas-Kanade at the predicted point positions and needs
+ * only enough pyramid levels to cover that error.
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+class MotionModel{
+public:
+  MotionModel(){reset();}
+  //Forgets the trajectory (object lost or re-detected elsewhere)
+  void reset();
+  //Box of the object in the frame just processed
+  void observe(const cv::Rect& box);
+  //Two boxes seen since the last reset, velocity known
+  bool ready() const {return frames>=2;}
+  //Positions in the next frame of points on box, the last observed box
+  void predict(const cv::Rect& box,const std::vector<cv::Point2f>& points,std::vector<cv::Point2f>& predicted) const;
+  //Expected distance of the actual positions from the predicted ones, pixels
+  float uncertainty() const;
+private:
+  int frames;
+  cv::Point2f center;
+  float side;            //sqrt of the box area
+  cv::Point2f velocity;  //center displacement per frame
+  float growth;          //side ratio per frame
+  float error;           //running mean of the center prediction error
+};
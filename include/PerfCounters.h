@@ -0,0 +1,40 @@
+/*
+ * PerfCounters.h
+ *
+ * Hardware event counters of the calling thread (Linux perf_event_open).
+ * Work handed to other threads (parallel_detect) is not counted. Counters
+ * the CPU, the kernel or perf_event_paranoid do not allow stay unavailable
+ * and read as -1.
+ */
+#pragma once
+#include <stdint.h>
+
+enum PerfEvent {
+  PERF_CYCLES = 0,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_REFERENCES,   //last level cache accesses
+  PERF_CACHE_MISSES,       //last level cache misses
+  PERF_L1D_READ_MISSES,
+  PERF_NUM_EVENTS
+};
+
+const char* perfEventName(int event);
+
+class PerfCounters{
+public:
+  PerfCounters();
+  ~PerfCounters();
+  //True if at least one counter could be opened
+  bool available() const;
+  //Counting happens between start() and stop(), totals add up over calls
+  void start();
+  void stop();
+  void reset();
+  //Total count, -1 if the event is unavailable
+  int64_t total(int event) const;
+private:
+  PerfCounters(const PerfCounters&);
+  PerfCounters& operator=(const PerfCounters&);
+  int fd[PERF_NUM_EVENTS];
+  int64_t totals[PERF_NUM_EVENTS];
+};
@@ -0,0 +1,163 @@
+/*
+ * Profiler.h
+ *
+ * Stage timers and counters for the per-frame hot path. Every frame records
+ * the time spent in each stage and a set of counters; per-stage latency
+ * histograms accumulate over the run and the last frames can be kept as a
+ * Chrome trace (chrome://tracing, ui.perfetto.dev).
+ * A disabled profiler costs one branch per stage.
+ * Different stages may be timed from different threads (track and detect
+ * run concurrently), one stage is only timed from one thread at a time.
+ */
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <JsonWriter.h>
+
+enum ProfStage {
+  PROF_FRAME = 0,
+  PROF_TRACK,
+  PROF_LK_FORWARD,
+  PROF_LK_BACKWARD,
+  PROF_NCC,
+  PROF_FILTER,
+  PROF_BBPREDICT,
+  PROF_DETECT,
+  PROF_INTEGRAL,
+  PROF_BLUR,
+  PROF_VARIANCE,
+  PROF_FERNS,
+  PROF_NN,
+  PROF_INTEGRATION,
+  PROF_LEARN,
+  PROF_WARPS,
+  PROF_NEGATIVES,
+  PROF_TRAIN_FERNS,
+  PROF_TRAIN_NN,
+  PROF_NUM_STAGES
+};
+
+enum ProfCounter {
+  PROF_WINDOWS = 0,        //windows in the grid
+  PROF_PASS_VARIANCE,      //windows passing the variance filter
+  PROF_PASS_FERNS,         //windows passing the fern ensemble
+  PROF_PASS_NN,            //windows accepted by the NN classifier
+  PROF_NN_COMPARISONS,     //patch comparisons against pEx/nEx
+  PROF_TRACKED_POINTS,     //points kept by the forward-backward filter
+  PROF_NUM_COUNTERS
+};
+
+const char* profStageName(int stage);
+const char* profCounterName(int counter);
+
+//Stage times (ms) and counters of one frame
+struct ProfFrame {
+  int frame;
+  double ms[PROF_NUM_STAGES];
+  int64_t counters[PROF_NUM_COUNTERS];
+};
+
+//Log-scale latency histogram, 4 buckets per power of two from 1us
+class ProfHistogram{
+public:
+  enum { BUCKETS = 4*26+1 };
+  ProfHistogram(){reset();}
+  void reset();
+  void add(double ms);
+  int count() const {return n;}
+  double mean() const {return n>0 ? sum/n : 0;}
+  double max() const {return maxv;}
+  //Upper bound of the bucket holding the p-th sample
+  double percentile(double p) const;
+  static double bucketLimit(int b);   //ms
+private:
+  int counts[BUCKETS];
+  int n;
+  double sum;
+  double maxv;
+};
+
+class Profiler{
+public:
+  explicit Profiler(bool on=true);
+  void setEnabled(bool on){enabled=on;}
+  bool isEnabled() const {return enabled;}
+  //Keep the stage events of the last max_frames frames for writeTrace(),
+  //off releases the kept events
+  void setTrace(bool on,int max_frames=1000);
+  void reset();
+
+  void beginFrame(int frame);
+  void endFrame();
+  void begin(int stage){
+    if (enabled)
+      start[stage] = now();
+  }
+  void end(int stage){
+    if (enabled)
+      record(stage,start[stage],now());
+  }
+  void count(int counter,int64_t n=1){
+    if (enabled)
+      current.counters[counter] += n;
+  }
+  //Times of the last completed frame
+  const ProfFrame& lastFrame() const {return last;}
+  const ProfHistogram& histogram(int stage) const {return histograms[stage];}
+  int frames() const {return num_frames;}
+  int64_t counterTotal(int counter) const {return totals[counter];}
+
+  //Stage histograms and counter totals
+  void writeJson(JsonWriter& json) const;
+  //Chrome trace event format
+  bool writeTrace(const std::string& path) const;
+
+  static int64_t now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+private:
+  struct TraceEvent {
+    int16_t stage;
+    int16_t tid;
+    int frame;
+    int64_t begin, end;  //ns
+  };
+  struct TraceFrame {
+    int frame;
+    int64_t end;         //ns
+    int64_t counters[PROF_NUM_COUNTERS];
+  };
+  void record(int stage,int64_t t0,int64_t t1);
+  bool enabled;
+  int64_t start[PROF_NUM_STAGES];
+  bool ran[PROF_NUM_STAGES];  //stage ran in the current frame
+  ProfFrame current;
+  ProfFrame last;
+  ProfHistogram histograms[PROF_NUM_STAGES];
+  int64_t totals[PROF_NUM_COUNTERS];
+  int num_frames;
+  //Trace rings
+  bool tracing;
+  int trace_frames;
+  std::vector<TraceEvent> events;
+  size_t events_next;
+  std::vector<TraceFrame> marks;
+  size_t marks_next;
+  std::shared_ptr<std::mutex> events_lock;  //appends from concurrent stages, shared by copies
+  int64_t origin;
+};
+
+//Times the enclosing block
+class ProfScope{
+public:
+  ProfScope(Profiler& p,int s):profiler(p),stage(s){profiler.begin(stage);}
+  ~ProfScope(){profiler.end(stage);}
+private:
+  Profiler& profiler;
+  int stage;
+};
@@ -0,0 +1,53 @@
+/*
+ * QuantizedNN.h
+ *
+ * NN examples stored as int8. A zero-mean patch x is kept as
+ * q = round(127*x/max|x|) with its scale max|x|/127 and the norm |q|, so the
+ * normalized correlation of two patches is dot(q1,q2)/(|q1||q2|) computed on
+ * integers. Patches are zero-padded to a multiple of 32 bytes, the dot
+ * product kernels have no tail loop. The kernel is picked at run time
+ * (CpuFeatures.h).
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+#include <vector>
+
+//Sum of a[i]*b[i], n a multiple of 32, with the kernel of cpuIsa()
+int dotInt8(const int8_t* a,const int8_t* b,int n);
+//With the kernel of isa (at most cpuIsaDetected())
+int dotInt8(int isa,const int8_t* a,const int8_t* b,int n);
+//Kernel dotInt8 uses: "avx512", "avx2", "sse4.1", "sse2" or "scalar"
+const char* dotInt8Kernel();
+
+class QuantizedPatches{
+public:
+  QuantizedPatches():stride(0){}
+  //Bytes per stored patch of the given number of pixels
+  static int strideFor(int pixels){return (pixels+31)&~31;}
+  //patch: CV_32F zero-mean, out: stride bytes
+  static void quantize(const cv::Mat& patch,int stride,int8_t* out,float& scale,float& norm);
+  void clear(){data.clear(); scales.clear(); norms.clear();}
+  int size() const {return scales.size();}
+  bool empty() const {return scales.empty();}
+  void push_back(const cv::Mat& patch);
+  //Copies n stored patches (stride bytes each) with their scales and norms
+  void assign(int stride,const int8_t* patches,const float* scales,const float* norms,int n);
+  const int8_t* patch(int i) const {return &data[(size_t)i*stride];}
+  float scale(int i) const {return scales[i];}
+  float norm(int i) const {return norms[i];}
+  int getStride() const {return stride;}
+  //Dequantized patch (side x side CV_32F)
+  cv::Mat toFloat(int i,int side) const;
+  //Normalized correlation of patch i with a quantized query of norm qnorm
+  float ncc(int i,const int8_t* query,float qnorm) const {
+    float d = norms[i]*qnorm;
+    return d>0 ? dotInt8(patch(i),query,stride)/d : 0;
+  }
+  size_t bytes() const {return data.size()+(scales.size()+norms.size())*sizeof(float);}
+private:
+  int stride;
+  std::vector<int8_t> data;
+  std::vector<float> scales;
+  std::vector<float> norms;
+};
@@ -0,0 +1,106 @@
+/*
+ * ResultSink.h
+ *
+ * Per-frame tracker output. TLD hands one ResultRecord per frame to a sink,
+ * the file sinks batch records and format/write them on a background thread.
+ */
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+struct ResultRecord {
+  int frame;         //frame index, 0 is the initialization frame
+  bool found;        //false: box and conf are undefined (NaN in the text output)
+  int x1, y1, x2, y2;//top-left and bottom-right corners
+  float conf;
+};
+
+class ResultSink{
+public:
+  virtual ~ResultSink(){}
+  virtual void write(const ResultRecord& r)=0;
+  //Blocks until every record written so far has been delivered
+  virtual void flush(){}
+};
+
+//Collects records in batches and delivers full batches on a writer thread
+class BatchedResultSink : public ResultSink{
+public:
+  BatchedResultSink(FILE* file,int batch_size);
+  ~BatchedResultSink();
+  bool isOpened(){return file!=NULL;}
+  void write(const ResultRecord& r);
+  void flush();
+protected:
+  //Writer thread only
+  virtual void writeBatch(FILE* file,const std::vector<ResultRecord>& batch)=0;
+  //Must be called by the destructor of derived classes (writeBatch is virtual)
+  void close();
+  FILE* file;
+private:
+  void run();
+  void submit(bool wait);
+  int batch_size;
+  std::vector<ResultRecord> batch;   //filled by the caller
+  std::vector<ResultRecord> pending; //handed to the writer
+  bool has_pending;
+  bool stop;
+  long submitted;
+  long written;
+  std::mutex mtx;
+  std::condition_variable cv_writer;
+  std::condition_variable cv_done;
+  std::thread writer;
+};
+
+//Text output, one "x1,y1,x2,y2,conf" line per frame (bounding_boxes.txt format)
+class CsvResultSink : public BatchedResultSink{
+public:
+  CsvResultSink(const std::string& path,int batch_size=256);
+  ~CsvResultSink();
+protected:
+  void writeBatch(FILE* file,const std::vector<ResultRecord>& batch);
+private:
+  std::vector<char> text;
+};
+
+//Binary output: BinaryResultHeader followed by fixed size BinaryResultEntry records
+struct BinaryResultHeader {
+  char magic[4];     //"TLDR"
+  unsigned version;  //BINARY_RESULT_VERSION
+  unsigned record_size;
+};
+struct BinaryResultEntry {
+  int frame;
+  int x1, y1, x2, y2;
+  float conf;
+  int found;
+};
+const unsigned BINARY_RESULT_VERSION = 1;
+
+class BinaryResultSink : public BatchedResultSink{
+public:
+  BinaryResultSink(const std::string& path,int batch_size=1024);
+  ~BinaryResultSink();
+  //Reads a whole file written by this sink, false if it is not one
+  static bool readFile(const std::string& path,std::vector<ResultRecord>& records);
+protected:
+  void writeBatch(FILE* file,const std::vector<ResultRecord>& batch);
+private:
+  std::vector<BinaryResultEntry> entries;
+};
+
+//Delivers every record synchronously to a user function
+class CallbackResultSink : public ResultSink{
+public:
+  typedef void (*Callback)(const ResultRecord& r,void* param);
+  CallbackResultSink(Callback callback,void* param=NULL):callback(callback),param(param){}
+  void write(const ResultRecord& r){callback(r,param);}
+private:
+  Callback callback;
+  void* param;
+};
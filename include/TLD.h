@@ -2,17 +2,59 @@
 #include <opencv2/legacy/legacy.hpp>
 #include <tld_utils.h>
 #include <LKTracker.h>
+#include <MotionModel.h>
 #include <FerNNClassifier.h>
+#include <ResultSink.h>
+#include <Profiler.h>
+#include <WindowGrid.h>
+#include <DetectionClusterer.h>
+#include <WorkerThread.h>
+#include <EquivalenceChecker.h>
 #include <fstream>
+#include <atomic>
 
 
-//Bounding Boxes
-struct BoundingBox : public cv::Rect {
-  BoundingBox(){}
-  BoundingBox(cv::Rect r): cv::Rect(r){}
-public:
-  float overlap;        //Overlap with current Bounding Box
-  int sidx;             //scale index
+//Per-stage processing times of one frame, in milliseconds
+struct TLDTimings {
+  double track;
+  double detect;
+  double learn;
+  double total;
+};
+
+//Work shed to keep a frame within frame_budget_ms, in the order it is applied
+enum TLDDegradation {
+  TLD_DEFER_LEARNING  = 1,  //no model update on this frame, the next frame with time left learns
+  TLD_LOCAL_DETECTION = 2,  //detection only scans the neighbourhood of the tracked box
+  TLD_PARTIAL_NN      = 4,  //NN verification stopped at the deadline, lowest ranked candidates unverified
+  TLD_TRACK_ONLY      = 8,  //no detection
+  TLD_INIT_PENDING    = 16  //detector still training after init (async_init), tracking only
+};
+
+//Output of one frame
+struct TLDResult {
+  int frame;            //0 is the initialization frame
+  bool found;           //box and conf are defined
+  bool valid;           //box is trusted enough to learn from
+  bool tracked;
+  bool detected;
+  cv::Rect box;
+  float conf;
+  std::vector<cv::Point2f> points1; //tracked points in the previous frame
+  std::vector<cv::Point2f> points2; //their position in the current frame
+  TLDTimings timings;
+  int degraded;         //TLDDegradation flags applied to this frame
+  ResultRecord record() const {
+    ResultRecord r;
+    r.frame = frame;
+    r.found = found;
+    r.x1 = box.x;
+    r.y1 = box.y;
+    r.x2 = box.br().x;
+    r.y2 = box.br().y;
+    r.conf = conf;
+    return r;
+  }
 };
 
 //Detection structure
@@ -25,21 +67,36 @@ struct DetStruct {
     std::vector<cv::Mat> patch;
   };
 //Temporal structure
+//Only windows passing the variance filter have fern results
   struct TempStruct {
-    std::vector<std::vector<int> > patt;
-    std::vector<float> conf;
+    std::vector<int> var_pass;  //windows passing the variance filter
+    std::vector<float> conf;    //fern confidence of var_pass[j]
+    std::vector<int> patt;      //fern codes of var_pass[j], num_trees per window
+    std::vector<int> fern_pass; //positions j passing the fern ensemble
+    //Tiled scan: position of each window in tile_conf/tile_patt, -1 between frames
+    std::vector<int> slot;
+    std::vector<float> tile_conf;
+    std::vector<int> tile_patt;
   };
 
+//Image at the pyramid levels the large scales are coded at (pyramid_detect):
+//levels[l] holds the pixels from origin on, 2^l times smaller (origin is a
+//multiple of 2^l), levels[0] is the image itself
+struct DetPyramid {
+  cv::Point origin;
+  std::vector<cv::Mat> levels;
+};
+
 struct OComparator{
-  OComparator(const std::vector<BoundingBox>& _grid):grid(_grid){}
-  std::vector<BoundingBox> grid;
+  OComparator(const std::vector<float>& _overlap):overlap(_overlap){}
+  const std::vector<float>& overlap;
   bool operator()(int idx1,int idx2){
-    return grid[idx1].overlap > grid[idx2].overlap;
+    return overlap[idx1] > overlap[idx2];
   }
 };
 struct CComparator{
   CComparator(const std::vector<float>& _conf):conf(_conf){}
-  std::vector<float> conf;
+  const std::vector<float>& conf;
   bool operator()(int idx1,int idx2){
     return conf[idx1]> conf[idx2];
   }
@@ -51,6 +108,8 @@ private:
   cv::PatchGenerator generator;
   FerNNClassifier classifier;
   LKTracker tracker;
+  MotionModel motion;
+  DetectionClusterer clusterer;
   ///Parameters
   int bbox_step;
   int min_win;
@@ -72,23 +131,46 @@ private:
   //parameters for negative examples
   float bad_overlap;
   float bad_patches;
+  //latency budget per frame in ms, 0: always run everything
+  float frame_budget_ms;
+  //detect() on a second thread while track() runs
+  bool parallel_detect;
+  //Grid: window shift relative to the smaller side, ratio of adjacent scales
+  //and number of scales (0: 0.1, 1.2 and 21)
+  float grid_shift;
+  float scale_step;
+  int num_scales;
+  //Scan windows tile by tile (side in pixels, -1: from the L2 cache size, 0: scale by scale)
+  int detect_tile;
+  //While tracked, detect only scales within this many steps of the object's, 0: all scales
+  int scale_gate;
+  //Start the tracker at the positions predicted by a constant velocity model
+  bool lk_motion;
+  //Track on frames halved while the box's smaller side stays at least this, 0: full resolution
+  int track_min_side;
+  //Code windows of scales at least twice the object's size on a pyramid level
+  bool pyramid_detect;
+  //init() returns once the tracker can start, the detector trains in the background
+  bool async_init;
   ///Variables
 //Integral Images
   cv::Mat iisum;
   cv::Mat iisqsum;
   float var;
 //Training data
-  std::vector<std::pair<std::vector<int>,int> > pX; //positive ferns <features,labels=1>
-  std::vector<std::pair<std::vector<int>,int> > nX; // negative ferns <features,labels=0>
+  FernTrainingSet pX; //positive ferns <features,labels=1>
+  FernTrainingSet nX; // negative ferns <features,labels=0>
   cv::Mat pEx;  //positive NN example
   std::vector<cv::Mat> nEx; //negative NN examples
 //Test data
-  std::vector<std::pair<std::vector<int>,int> > nXT; //negative data to Test
+  FernTrainingSet nXT; //negative data to Test
   std::vector<cv::Mat> nExT; //negative NN examples to Test
 //Last frame data
   BoundingBox lastbox;
   bool lastvalid;
+  bool lastboxfound;
   float lastconf;
+  int frame_idx;        //index of the last processed frame
 //Current frame data
   //Tracker data
   bool tracked;
@@ -97,38 +179,105 @@ private:
   float tconf;
   //Detector data
   TempStruct tmp;
+  cv::Mat blurred;        //blurred frame of detect(), reused across frames
+  DetPyramid pyramid;
+  std::vector<int> scale_levels;  //pyramid level of each grid scale (pyramid_detect)
   DetStruct dt;
   std::vector<BoundingBox> dbb;
   std::vector<bool> dvalid;
   std::vector<float> dconf;
   bool detected;
+  //Degradation
+  int degraded;           //TLDDegradation flags of the current frame
+  double detect_ms;       //running mean of a full detect() (0: not measured yet)
+  double gated_ms;        //running mean of a scale gated detect() (scale_gate)
+  double learn_ms;        //running mean of learn()
+  int detect_shed;        //frames since the last detect() of the planned region
+  int learn_shed;         //frames learning was deferred since it last ran
+  //Runs detect() with parallel_detect. detect() only writes the detector
+  //data and integral images, track() only the tracker data; both read the
+  //classifier, which is safe for concurrent NNConf/measure_forest calls.
+  WorkerThread detector;
+  //Trains the detector on the first frame with async_init. Until init_done
+  //is set processFrame only tracks, without the classifier.
+  WorkerThread trainer;
+  bool init_pending;
+  std::atomic<bool> init_done;
 
 
   //Bounding Boxes
-  std::vector<BoundingBox> grid;
-  std::vector<cv::Size> scales;
+  WindowGrid grid;
   std::vector<int> good_boxes; //indexes of bboxes with overlap > 0.6
+  std::vector<float> good_overlap; //overlap of good_boxes[i]
   std::vector<int> bad_boxes; //indexes of bboxes with overlap < 0.2
   BoundingBox bbhull; // hull of good_boxes
   BoundingBox best_box; // maximum overlapping bbox
+  bool show_examples;   // display the NN examples after learning (needs highgui)
+  Profiler prof;        // stage timers and counters of processFrame
+  EquivalenceChecker* checker; // reference run of every stage, not owned (NULL: off)
+  friend class EquivalenceChecker;
 
 public:
   //Constructors
   TLD();
   TLD(const cv::FileNode& file);
+  ~TLD();
   void read(const cv::FileNode& file);
   //Methods
-  void init(const cv::Mat& frame1,const cv::Rect &box, FILE* bb_file);
+  void init(const cv::Mat& frame1,const cv::Rect &box,TLDResult& result);
+  //Blocks until the detector of async_init is trained
+  void waitInit();
+  //Examples of the first frame and classifier training (the detector part of init)
+  void trainDetector(const cv::Mat& frame1,const cv::Rect& box);
+  //Model snapshots (see ModelFile.h). loadModel replaces init(): an empty box
+  //resumes from the saved object position, otherwise tracking starts at box.
+  bool saveModel(const std::string& path);
+  bool loadModel(const std::string& path,const cv::Mat& frame1,const cv::Rect& box,TLDResult& result);
+  void setShowExamples(bool show){show_examples=show;}
+  Profiler& profiler(){return prof;}
+  //Recompute every stage with the reference implementations (see EquivalenceChecker.h)
+  void setChecker(EquivalenceChecker* c){checker=c;}
+  //Turn off the optional fast paths (tiled scan, int8 NN, parallel detection),
+  //before init. Fast paths added later have to be turned off here as well.
+  void setReferencePaths();
   void generatePositiveData(const cv::Mat& frame, int num_warps);
   void generateNegativeData(const cv::Mat& frame);
-  void processFrame(const cv::Mat& img1,const cv::Mat& img2,std::vector<cv::Point2f>& points1,std::vector<cv::Point2f>& points2,
-      BoundingBox& bbnext,bool& lastboxfound, bool tl,FILE* bb_file);
+  void processFrame(const cv::Mat& img1,const cv::Mat& img2,TLDResult& result,bool tl);
   void track(const cv::Mat& img1, const cv::Mat& img2,std::vector<cv::Point2f>& points1,std::vector<cv::Point2f>& points2);
-  void detect(const cv::Mat& frame);
+  //Halvings of the frame for tracking box (track_min_side), the crop of both
+  //frames around it at that level and the crop's offset in the frame (false:
+  //box outside the frame)
+  int trackingLevel(const BoundingBox& box) const;
+  bool trackingFrames(const cv::Mat& img1,const cv::Mat& img2,const BoundingBox& box,int level,
+      cv::Mat& small1,cv::Mat& small2,cv::Point2f& offset);
+  //Windows inside roi (empty: whole frame) of the grid scales [scales.start,scales.end)
+  //(empty: all) only, NN verification stops at deadline (ticks, 0: none);
+  //returns the number of windows scanned
+  int detect(const cv::Mat& frame,const cv::Rect& roi=cv::Rect(),int64 deadline=0,const cv::Range& scales=cv::Range());
+  //Degradations, detection region and scales for the time left until deadline
+  //and the object's box (if have_box)
+  void planDetection(const BoundingBox& around,bool have_box,int64 now,int64 deadline,bool tl,const cv::Size& frame,
+      cv::Rect& roi,cv::Range& scales);
+  //detect() as planned, updates the running mean of its kind of scan
+  void runDetection(const cv::Mat& img,const cv::Rect& roi,int64 deadline,const cv::Range& scales);
+  //Variance filter and fern ensemble over the windows inside roi and scales,
+  //filling tmp in window order; returns the number of windows scanned.
+  //scanScales walks one scale at a time, scanTiled every scale anchored in
+  //one tile of the frame while its pixels are in cache (same results).
+  int scanScales(const cv::Mat& img,const cv::Rect& roi,const cv::Range& scales);
+  int scanTiled(const cv::Mat& img,const cv::Rect& roi,const cv::Range& scales);
+  //Fern codes of window w at its scale's pyramid level
+  void windowFeatures(const DetPyramid& pyr,const BoundingBox& w,std::vector<int>& fern);
+  //Pyramid of img for the windows inside area, and the part of img it reads
+  //(area grown by the pyrDown borders, aligned to the coarsest level)
+  void buildPyramid(const cv::Mat& img,const cv::Rect& area,DetPyramid& pyr);
+  cv::Rect pyramidArea(const cv::Rect& area,const cv::Size& frame) const;
   void clusterConf(const std::vector<BoundingBox>& dbb,const std::vector<float>& dconf,std::vector<BoundingBox>& cbb,std::vector<float>& cconf);
   void evaluate();
   void learn(const cv::Mat& img);
+  void getResult(TLDResult& result);
   //Tools
+  void setup(const cv::Mat& frame1,const cv::Rect& box);
   void buildGrid(const cv::Mat& img, const cv::Rect& box);
   float bbOverlap(const BoundingBox& box1,const BoundingBox& box2);
   void getOverlappingBoxes(const cv::Rect& box1,int num_closest);
@@ -138,7 +287,5 @@ public:
   void bbPredict(const std::vector<cv::Point2f>& points1,const std::vector<cv::Point2f>& points2,
       const BoundingBox& bb1,BoundingBox& bb2);
   double getVar(const BoundingBox& box,const cv::Mat& sum,const cv::Mat& sqsum);
-  bool bbComp(const BoundingBox& bb1,const BoundingBox& bb2);
-  int clusterBB(const std::vector<BoundingBox>& dbb,std::vector<int>& indexes);
 };
 
@@ -0,0 +1,52 @@
+/*
+ * TLDSession.h
+ *
+ * Library entry point: one tracked object in one gray video stream.
+ * A session owns all of its state, any number of sessions can run in the
+ * same process (each one used from one thread at a time).
+ */
+#pragma once
+#include <TLD.h>
+#include <string>
+
+class TLDSession{
+public:
+  //Parameters as in parameters.yml
+  explicit TLDSession(const cv::FileNode& params);
+  explicit TLDSession(const std::string& params_file);
+  //First frame and object box
+  const TLDResult& init(const cv::Mat& gray,const cv::Rect& box,bool borrow=false);
+  //Warm start from a model saved with saveModel(), empty box resumes at the saved position
+  bool loadModel(const std::string& path,const cv::Mat& gray,const cv::Rect& box=cv::Rect(),bool borrow=false);
+  bool saveModel(const std::string& path);
+  //Next frame (8 bit, one channel). The frame is copied unless borrow is set,
+  //a borrowed frame must stay unchanged until the following process() returns.
+  const TLDResult& process(const cv::Mat& gray,bool borrow=false);
+  //Zero-copy variant for caller owned buffers (always borrowed)
+  const TLDResult& process(const uchar* data,int width,int height,size_t step);
+  const TLDResult& result() const {return res;}
+  bool isInitialized() const {return initialized;}
+  //Track and learn (default), or detection only with a fixed model
+  void setLearning(bool learn){learning=learn;}
+  //Every result (including init) is also written here, not owned
+  void setSink(ResultSink* s){sink=s;}
+  void setShowExamples(bool show){tld.setShowExamples(show);}
+  //Stage timers, histograms and trace of process() (see Profiler.h)
+  Profiler& profiler(){return tld.profiler();}
+  //Stage-by-stage comparison with the reference implementations, not owned
+  void setChecker(EquivalenceChecker* c){tld.setChecker(c);}
+  //Optional fast paths off, before init (reference run of tld_check)
+  void setReferencePaths(){tld.setReferencePaths();}
+private:
+  TLDSession(const TLDSession&);
+  TLDSession& operator=(const TLDSession&);
+  void keepFrame(const cv::Mat& gray,bool borrow);
+  TLD tld;
+  cv::Mat buffers[2];   //owned copies of the last two frames
+  int current;          //buffer holding the last frame
+  cv::Mat last;         //last frame, a buffer or a borrowed caller frame
+  bool initialized;
+  bool learning;
+  ResultSink* sink;
+  TLDResult res;
+};
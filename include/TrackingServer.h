@@ -0,0 +1,79 @@
+/*
+ * TrackingServer.h
+ *
+ * Many TLD sessions in one process on a shared pool of worker threads.
+ * Every stream has a reader thread filling a bounded frame queue and one
+ * TLDSession. Workers take the next frame of the runnable stream that has
+ * received the least processing time relative to its priority (a stream is
+ * never processed by two workers at once, its frames depend on each other).
+ * When a stream falls behind its oldest frames are dropped, so it keeps
+ * tracking the most recent image instead of building up latency.
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <TLDSession.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct StreamSpec {
+  StreamSpec():priority(1){}
+  std::string name;
+  //Video file, or raw:WIDTHxHEIGHT:path for 8 bit gray frames read from a
+  //file, a FIFO or - (stdin)
+  std::string source;
+  cv::Rect box;
+  int priority;         //share of the workers relative to other streams
+};
+
+struct StreamStats {
+  int decoded;          //frames read from the source
+  int processed;        //frames given to the session (including init)
+  int dropped;          //frames shed because the stream fell behind
+  int found;
+  double busy_ms;       //worker time spent on the stream
+  double latency_ms;    //sum of read-to-result times
+  double max_latency_ms;
+};
+
+struct ServerOptions {
+  ServerOptions():workers(0),max_queue(4),max_age_ms(0),fps(0),learning(false){}
+  int workers;          //0: hardware threads
+  int max_queue;        //frames queued per stream before the oldest is dropped
+  double max_age_ms;    //frames older than this are dropped when newer ones wait, 0: off
+  double fps;           //pace file sources like a camera, 0: as fast as they decode
+  bool learning;
+  std::string output;   //directory of the <name>.txt results, empty: none
+};
+
+//Lines "name source x y width height [priority]", # starts a comment
+bool readStreamList(const std::string& path,std::vector<StreamSpec>& specs);
+
+class TrackingServer{
+public:
+  TrackingServer(const cv::FileNode& params,const ServerOptions& opt);
+  ~TrackingServer();
+  void addStream(const StreamSpec& spec);
+  //Runs every stream to the end of its source
+  void run();
+  int numStreams() const {return streams.size();}
+  const StreamSpec& spec(int s) const;
+  StreamStats stats(int s);
+private:
+  struct Stream;
+  TrackingServer(const TrackingServer&);
+  TrackingServer& operator=(const TrackingServer&);
+  void read(Stream& s);
+  void work();
+  Stream* next();
+  void push(Stream& s,const cv::Mat& gray);
+  cv::FileNode params;
+  ServerOptions opt;
+  std::vector<Stream*> streams;
+  double vtime;         //virtual time of the last scheduled stream
+  std::mutex mtx;
+  std::condition_variable cv_work;
+};
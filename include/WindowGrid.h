@@ -0,0 +1,71 @@
+/*
+ * WindowGrid.h
+ *
+ * Scanning windows of the detector. Windows of one scale lie on a regular
+ * lattice, so the grid only stores origin, step and count per scale and
+ * window indices are decoded arithmetically. Per-window state lives in
+ * side arrays indexed by window (see TLD).
+ *
+ * Overlap queries bound the lattice rows and columns that can reach an
+ * overlap from the box geometry, so they only evaluate windows near the box.
+ */
+#pragma once
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+//Bounding Boxes
+struct BoundingBox : public cv::Rect {
+  BoundingBox(){}
+  BoundingBox(cv::Rect r): cv::Rect(r){}
+public:
+  int sidx;             //scale index
+};
+
+//Windows of one size: x = x0 + col*step, y = y0 + row*step
+struct GridScale {
+  cv::Size size;
+  int x0, y0;
+  int step;
+  int cols, rows;
+  int first;            //index of the first window of this scale
+  int count() const {return cols*rows;}
+};
+
+class WindowGrid{
+public:
+  WindowGrid():total(0){}
+  //Windows of num_scales scales (scale_step^-(num_scales-1)/2 and up) of box
+  //within the frame, shifted by shift times the smaller side, scales below
+  //min_win are skipped. 0 keeps the defaults: 21 scales of 1.2, shift 0.1.
+  void build(const cv::Size& frame,const cv::Rect& box,int min_win,float shift=0,float scale_step=0,int num_scales=0);
+  void clear();
+  int size() const {return total;}
+  int numScales() const {return scales.size();}
+  const GridScale& scale(int s) const {return scales[s];}
+  std::vector<cv::Size> scaleSizes() const;
+  //Object size the scales were built from
+  cv::Size box() const {return box_size;}
+  int scaleOf(int idx) const;
+  //Scale whose window size is closest to size (in log area), -1 without scales
+  int nearestScale(const cv::Size& size) const;
+  BoundingBox window(int idx) const {
+    int s = scaleOf(idx);
+    const GridScale& g = scales[s];
+    int local = idx-g.first;
+    BoundingBox bb(cv::Rect(g.x0+(local%g.cols)*g.step,g.y0+(local/g.cols)*g.step,g.size.width,g.size.height));
+    bb.sidx = s;
+    return bb;
+  }
+  //Windows overlapping box by more than min_overlap, in index order
+  void overlapping(const cv::Rect& box,double min_overlap,std::vector<int>& idx,std::vector<float>& overlap) const;
+  //Windows overlapping box by less than max_overlap, in index order
+  void farFrom(const cv::Rect& box,float max_overlap,std::vector<int>& idx) const;
+  //First window of maximum overlap with box, -1 if no window overlaps it
+  int closest(const cv::Rect& box,float& overlap) const;
+private:
+  //Lattice columns [c0,c1) and rows [r0,r1) of scale g that can overlap box by min_overlap or more
+  bool candidates(const GridScale& g,const cv::Rect& box,float min_overlap,int& c0,int& c1,int& r0,int& r1) const;
+  std::vector<GridScale> scales;
+  cv::Size box_size;
+  int total;
+};
@@ -0,0 +1,33 @@
+/*
+ * WorkerThread.h
+ *
+ * One background thread that runs one job at a time. The thread is started
+ * by the first job and kept for the following ones, so handing work to it
+ * costs a wake-up instead of a thread creation.
+ */
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class WorkerThread{
+public:
+  WorkerThread():busy(false),stop(false){}
+  ~WorkerThread();
+  //Starts job, the previous one must have been waited for
+  void run(const std::function<void()>& job);
+  //Blocks until the job has finished
+  void wait();
+private:
+  WorkerThread(const WorkerThread&);
+  WorkerThread& operator=(const WorkerThread&);
+  void loop();
+  std::function<void()> job;
+  bool busy;
+  bool stop;
+  std::mutex mtx;
+  std::condition_variable cv_job;
+  std::condition_variable cv_done;
+  std::thread worker;
+};
@@ -0,0 +1,55 @@
+/*
+ * tld_eval.h
+ *
+ * Accuracy and timing statistics for the benchmarks. The accuracy measure is
+ * the one of datasets/evaluate_vis.py: a frame is a correct detection when
+ * the output box overlaps the true box by more than 0.25.
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <ResultSink.h>
+
+//Box as in gt.txt / bounding_boxes.txt, valid is false for NaN lines
+struct EvalBox {
+  bool valid;
+  float x1, y1, x2, y2;
+};
+
+struct EvalScore {
+  int frames;             //frames compared
+  int detections;         //frames with an output box
+  int true_detections;    //frames with a true box
+  int correct_detections; //overlap > 0.25
+  double precision;
+  double recall;
+  double f_measure;
+};
+
+struct LatencyStats {
+  int count;
+  double mean;
+  double p50, p90, p99;
+  double max;
+};
+
+//Reads a box file, false if it can't be opened
+bool readBoxes(const std::string& path,std::vector<EvalBox>& boxes);
+
+EvalBox toEvalBox(const ResultRecord& r);
+
+//Overlap of evaluate_vis.py (no +1 on the sides, 0 if either box is invalid)
+double evalOverlap(const EvalBox& bb1,const EvalBox& bb2);
+
+//Compares the first min(boxes,truth) frames
+EvalScore evaluate(const std::vector<EvalBox>& boxes,const std::vector<EvalBox>& truth,double min_overlap=0.25);
+
+//Sorts a copy of the samples
+LatencyStats latencyStats(std::vector<double> samples);
+
+//Dataset layout: one directory per sequence with a .mpg, init.txt and gt.txt
+bool isDirectory(const std::string& path);
+//Sorted entries of a directory (without . and ..)
+std::vector<std::string> listDirectory(const std::string& path);
+//The .mpg of a sequence directory, empty if there is none
+std::string findVideo(const std::string& dir);
@@ -0,0 +1,66 @@
+/*
+ * tld_log.h
+ *
+ * Leveled logging for the tracker.
+ * Calls below TLD_LOG_COMPILE_LEVEL expand to nothing, so debug output costs
+ * nothing in Release builds (NDEBUG). Enabled messages are formatted into a
+ * lock-free ring and written to stdout by a background thread, the caller
+ * never blocks on console I/O. Each message is one line, no trailing '\n'.
+ */
+#pragma once
+
+enum {
+  TLD_LOG_DEBUG = 0,
+  TLD_LOG_INFO  = 1,
+  TLD_LOG_WARN  = 2,
+  TLD_LOG_ERROR = 3,
+  TLD_LOG_NONE  = 4
+};
+
+//Lowest level compiled in. Override with -DTLD_LOG_COMPILE_LEVEL=n
+#ifndef TLD_LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define TLD_LOG_COMPILE_LEVEL TLD_LOG_INFO
+#else
+#define TLD_LOG_COMPILE_LEVEL TLD_LOG_DEBUG
+#endif
+#endif
+
+//Runtime level (default INFO, or TLD_LOG_LEVEL=debug|info|warn|error|none)
+void tld_log_set_level(int level);
+int tld_log_get_level();
+bool tld_log_enabled(int level);
+//Prefix every line with time, level and thread id
+void tld_log_set_structured(bool structured);
+//Queue a message, drops it (and counts the drop) if the ring is full
+void tld_log_write(int level, const char* fmt, ...)
+#ifdef __GNUC__
+  __attribute__((format(printf,2,3)))
+#endif
+  ;
+//Block until every message queued so far has been written
+void tld_log_flush();
+
+#define TLD_LOG(level, ...) \
+  do { if (tld_log_enabled(level)) tld_log_write(level, __VA_ARGS__); } while (0)
+
+#if TLD_LOG_COMPILE_LEVEL <= 0
+#define TLD_DEBUG(...) TLD_LOG(TLD_LOG_DEBUG, __VA_ARGS__)
+#else
+#define TLD_DEBUG(...) do {} while (0)
+#endif
+#if TLD_LOG_COMPILE_LEVEL <= 1
+#define TLD_INFO(...) TLD_LOG(TLD_LOG_INFO, __VA_ARGS__)
+#else
+#define TLD_INFO(...) do {} while (0)
+#endif
+#if TLD_LOG_COMPILE_LEVEL <= 2
+#define TLD_WARN(...) TLD_LOG(TLD_LOG_WARN, __VA_ARGS__)
+#else
+#define TLD_WARN(...) do {} while (0)
+#endif
+#if TLD_LOG_COMPILE_LEVEL <= 3
+#define TLD_ERROR(...) TLD_LOG(TLD_LOG_ERROR, __VA_ARGS__)
+#else
+#define TLD_ERROR(...) do {} while (0)
+#endif
@@ -11,5 +11,8 @@ cv::Mat createMask(const cv::Mat& image, CvRect box);
 
 float median(std::vector<float> v);
 
+//Intersection over union of two boxes
+float bbOverlap(const cv::Rect& box1,const cv::Rect& box2);
+
 std::vector<int> index_shuffle(int begin,int end);
 
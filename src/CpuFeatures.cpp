@@ -0,0 +1,73 @@
+/*
+ * CpuFeatures.cpp
+ */
+
+#include <CpuFeatures.h>
+#include <tld_log.h>
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* isa_names[ISA_NUM] = {"scalar","sse2","sse4.1","avx2","avx512"};
+
+const char* cpuIsaName(int isa){
+  return isa>=0 && isa<ISA_NUM ? isa_names[isa] : "unknown";
+}
+
+int cpuIsaDetected(){
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    return ISA_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return ISA_AVX2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return ISA_SSE41;
+  if (__builtin_cpu_supports("sse2"))
+    return ISA_SSE2;
+#endif
+  return ISA_SCALAR;
+}
+
+static int isaByName(const char* name){
+  for (int i=0;i<ISA_NUM;i++){
+      if (strcmp(name,isa_names[i])==0)
+        return i;
+  }
+  return -1;
+}
+
+//-1 until the first cpuIsa() call, which reads TLD_ISA (TLD constructors)
+static std::atomic<int> selected(-1);
+
+int cpuIsa(){
+  int isa = selected.load(std::memory_order_relaxed);
+  if (isa>=0)
+    return isa;
+  isa = cpuIsaDetected();
+  const char* env = getenv("TLD_ISA");
+  if (env && *env){
+      int wanted = isaByName(env);
+      if (wanted<0 || wanted>isa)
+        TLD_WARN("TLD_ISA=%s is not available, using %s",env,cpuIsaName(isa));
+      else
+        isa = wanted;
+  }
+  if (isa==ISA_SCALAR)
+    cv::setUseOptimized(false);
+  selected = isa;
+  return isa;
+}
+
+bool setCpuIsa(int isa){
+  if (isa<0 || isa>cpuIsaDetected())
+    return false;
+  selected = isa;
+  cv::setUseOptimized(isa>ISA_SCALAR);
+  return true;
+}
+
+bool setCpuIsa(const char* name){
+  return setCpuIsa(isaByName(name));
+}
@@ -0,0 +1,161 @@
+/*
+ * DetectionClusterer.cpp
+ */
+
+#include <DetectionClusterer.h>
+#include <tld_utils.h>
+#include <tld_log.h>
+#include <algorithm>
+using namespace cv;
+using namespace std;
+
+struct XComparator{
+  XComparator(const vector<BoundingBox>& _bb):bb(_bb){}
+  const vector<BoundingBox>& bb;
+  bool operator()(int idx1,int idx2){
+    return bb[idx1].x < bb[idx2].x;
+  }
+};
+
+struct ConfComparator{
+  ConfComparator(const vector<float>& _conf):conf(_conf){}
+  const vector<float>& conf;
+  bool operator()(int idx1,int idx2){
+    return conf[idx1] > conf[idx2];
+  }
+};
+
+void DetectionClusterer::read(const FileNode& file){
+  nms = (int)file["cluster_nms"]!=0;
+}
+
+int DetectionClusterer::find(int i){
+  while (parent[i]!=i){
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+  }
+  return i;
+}
+
+int DetectionClusterer::partition(const vector<BoundingBox>& dbb,vector<int>& T){
+  int n = dbb.size();
+  order.resize(n);
+  parent.resize(n);
+  for (int i=0;i<n;i++){
+      order[i] = i;
+      parent[i] = i;
+  }
+  sort(order.begin(),order.end(),XComparator(dbb));
+  //bbOverlap is 0 once a box starts right of the other one's end
+  for (int a=0;a<n;a++){
+      const BoundingBox& b1 = dbb[order[a]];
+      for (int b=a+1;b<n;b++){
+          const BoundingBox& b2 = dbb[order[b]];
+          if (b2.x > b1.x+b1.width)
+            break;
+          if (bbOverlap(b1,b2)<threshold)
+            continue;
+          int r1 = find(order[a]);
+          int r2 = find(order[b]);
+          if (r1!=r2)
+            parent[max(r1,r2)] = min(r1,r2);
+      }
+  }
+  //Number the clusters by their first detection
+  T.resize(n);
+  int c = 0;
+  for (int i=0;i<n;i++){
+      int r = find(i);
+      T[i] = r==i ? c++ : T[r];
+  }
+  return c;
+}
+
+void DetectionClusterer::cluster(const vector<BoundingBox>& dbb,const vector<float>& dconf,vector<BoundingBox>& cbb,vector<float>& cconf){
+  int numbb =dbb.size();
+  float space_thr = 0.5;
+  int c=1;
+  if (nms){
+      suppress(dbb,dconf,cbb,cconf);
+      return;
+  }
+  switch (numbb){
+  case 1:
+    cbb=vector<BoundingBox>(1,dbb[0]);
+    cconf=vector<float>(1,dconf[0]);
+    return;
+  case 2:
+    labels.assign(2,0);
+    if (1-bbOverlap(dbb[0],dbb[1])>space_thr){
+      labels[1]=1;
+      c=2;
+    }
+    break;
+  default:
+    c = partition(dbb,labels);
+    break;
+  }
+  cconf.assign(c,0);
+  cbb.resize(c);
+  vector<int> N(c,0), mx(c,0), my(c,0), mw(c,0), mh(c,0);
+  for (int j=0;j<numbb;j++){
+      int i = labels[j];
+      cconf[i]+=dconf[j];
+      mx[i]+=dbb[j].x;
+      my[i]+=dbb[j].y;
+      mw[i]+=dbb[j].width;
+      mh[i]+=dbb[j].height;
+      N[i]++;
+  }
+  BoundingBox bx;
+  for (int i=0;i<c;i++){
+      cconf[i]=cconf[i]/N[i];
+      bx.x=cvRound(mx[i]/N[i]);
+      bx.y=cvRound(my[i]/N[i]);
+      bx.width=cvRound(mw[i]/N[i]);
+      bx.height=cvRound(mh[i]/N[i]);
+      cbb[i]=bx;
+      TLD_DEBUG("Cluster %d: %d detections",i,N[i]);
+  }
+}
+
+void DetectionClusterer::suppress(const vector<BoundingBox>& dbb,const vector<float>& dconf,vector<BoundingBox>& cbb,vector<float>& cconf){
+  int n = dbb.size();
+  order.resize(n);
+  labels.assign(n,-1);
+  for (int i=0;i<n;i++)
+    order[i] = i;
+  stable_sort(order.begin(),order.end(),ConfComparator(dconf));
+  cbb.clear();
+  cconf.clear();
+  for (int a=0;a<n;a++){
+      int i = order[a];
+      if (labels[i]>=0)
+        continue;
+      int c = cbb.size();
+      float w=0, cnf=0, x=0, y=0, wd=0, ht=0;
+      int N=0;
+      for (int b=a;b<n;b++){
+          int j = order[b];
+          if (labels[j]>=0 || (j!=i && bbOverlap(dbb[i],dbb[j])<threshold))
+            continue;
+          labels[j] = c;
+          float k = max(dconf[j],1e-6f);
+          x += k*dbb[j].x;
+          y += k*dbb[j].y;
+          wd += k*dbb[j].width;
+          ht += k*dbb[j].height;
+          w += k;
+          cnf += dconf[j];
+          N++;
+      }
+      BoundingBox bx;
+      bx.x=cvRound(x/w);
+      bx.y=cvRound(y/w);
+      bx.width=cvRound(wd/w);
+      bx.height=cvRound(ht/w);
+      cbb.push_back(bx);
+      cconf.push_back(cnf/N);
+      TLD_DEBUG("NMS group %d: %d detections",c,N);
+  }
+}
@@ -0,0 +1,233 @@
+/*
+ * EquivalenceChecker.cpp
+ */
+
+#include <EquivalenceChecker.h>
+#include <TLD.h>
+#include <math.h>
+#include <string.h>
+using namespace cv;
+using namespace std;
+
+//Confidences closer than this are the same output (float rounding)
+static const double CONF_TOLERANCE = 1e-5;
+
+static const char* stage_names[CHECK_NUM_STAGES] = {"variance","ferns","nn","track"};
+
+const char* checkStageName(int stage){
+  return stage_names[stage];
+}
+
+EquivalenceChecker::EquivalenceChecker():frame(0){
+  reset();
+}
+
+void EquivalenceChecker::reset(){
+  memset(stages,0,sizeof(stages));
+  for (int s=0;s<CHECK_NUM_STAGES;s++)
+    stages[s].first_frame = -1;
+}
+
+void EquivalenceChecker::merge(const EquivalenceChecker& other){
+  for (int s=0;s<CHECK_NUM_STAGES;s++){
+      StageDivergence& d = stages[s];
+      const StageDivergence& o = other.stages[s];
+      d.checked += o.checked;
+      d.decisions += o.decisions;
+      d.mismatches += o.mismatches;
+      d.max_delta = max(d.max_delta,o.max_delta);
+      d.sum_delta += o.sum_delta;
+  }
+}
+
+bool EquivalenceChecker::diverged() const {
+  for (int s=0;s<CHECK_NUM_STAGES;s++){
+      if (stages[s].decisions>0 || stages[s].mismatches>0)
+        return true;
+  }
+  return false;
+}
+
+void EquivalenceChecker::add(int s,bool decision,bool mismatch,double delta){
+  StageDivergence& d = stages[s];
+  d.checked++;
+  d.decisions += decision;
+  d.mismatches += mismatch;
+  d.max_delta = max(d.max_delta,delta);
+  d.sum_delta += delta;
+  if ((decision || mismatch) && d.first_frame<0)
+    d.first_frame = frame;
+}
+
+void EquivalenceChecker::writeJson(JsonWriter& json) const {
+  json.beginObject();
+  for (int s=0;s<CHECK_NUM_STAGES;s++){
+      const StageDivergence& d = stages[s];
+      json.key(stage_names[s]).beginObject();
+      json.member("checked",(double)d.checked);
+      json.member("decisions",(double)d.decisions);
+      json.member("mismatches",(double)d.mismatches);
+      json.member("max_delta",d.max_delta);
+      json.member("mean_delta",d.checked>0 ? d.sum_delta/d.checked : 0.0);
+      json.member("first_frame",d.first_frame);
+      json.endObject();
+  }
+  json.endObject();
+}
+
+//Variance of the window's pixels, summed directly
+double EquivalenceChecker::refVar(const Mat& frame,const Rect& box){
+  double sum = 0, sqsum = 0;
+  for (int y=box.y;y<box.br().y;y++){
+      const uchar* row = frame.ptr<uchar>(y);
+      for (int x=box.x;x<box.br().x;x++){
+          sum += row[x];
+          sqsum += (double)row[x]*row[x];
+      }
+  }
+  double mean = sum/box.area();
+  return sqsum/box.area()-mean*mean;
+}
+
+void EquivalenceChecker::refFeatures(TLD& tld,const vector<Mat>& pyr,const BoundingBox& w,vector<int>& code){
+  FerNNClassifier& c = tld.classifier;
+  int scale = w.sidx;
+  int trees = c.getNumStructs();
+  int depth = c.features[scale].size()/trees;
+  code.resize(trees);
+  //pyramid_detect: the window's pixels at its level, the features halved l times
+  int l = c.getLevel(scale);
+  Mat patch = pyr[l](Rect(w.x>>l,w.y>>l,((w.width-1)>>l)+1,((w.height-1)>>l)+1));
+  //Same feature layout as getFeatures (tree t starts at t*num_features)
+  for (int t=0;t<trees;t++){
+      int leaf = 0;
+      for (int f=0;f<depth;f++){
+          const FerNNClassifier::Feature& ft = c.features[scale][t*depth+f];
+          leaf = (leaf<<1)+(patch.at<uchar>(ft.y1>>l,ft.x1>>l)>patch.at<uchar>(ft.y2>>l,ft.x2>>l));
+      }
+      code[t] = leaf;
+  }
+}
+
+float EquivalenceChecker::refForest(TLD& tld,const vector<int>& code){
+  float votes = 0;
+  for (size_t t=0;t<code.size();t++)
+    votes += tld.classifier.posteriors[t][code[t]];
+  return votes;
+}
+
+//CV_TM_CCORR_NORMED of two patches of the same size
+double EquivalenceChecker::refNCC(const Mat& a,const Mat& b){
+  double ab = 0, aa = 0, bb = 0;
+  for (int y=0;y<a.rows;y++){
+      const float* pa = a.ptr<float>(y);
+      const float* pb = b.ptr<float>(y);
+      for (int x=0;x<a.cols;x++){
+          ab += (double)pa[x]*pb[x];
+          aa += (double)pa[x]*pa[x];
+          bb += (double)pb[x]*pb[x];
+      }
+  }
+  return aa>0 && bb>0 ? ab/sqrt(aa*bb) : 0;
+}
+
+void EquivalenceChecker::refNNConf(TLD& tld,const Mat& pattern,float& rsconf,float& csconf){
+  FerNNClassifier& c = tld.classifier;
+  int num_pex = c.numPositive();
+  int num_nex = c.numNegative();
+  if (num_pex==0 || num_nex==0){
+      rsconf = csconf = num_pex==0 ? 0 : 1;
+      return;
+  }
+  int validated = ceil(num_pex*c.getValid());
+  double maxP = 0, csmaxP = 0, maxN = 0;
+  for (int i=0;i<num_pex;i++){
+      double n = (refNCC(c.positive(i),pattern)+1)*0.5;
+      if (n>maxP){
+          maxP = n;
+          if (i<validated)
+            csmaxP = n;
+      }
+  }
+  for (int i=0;i<num_nex;i++)
+    maxN = max(maxN,(refNCC(c.negative(i),pattern)+1)*0.5);
+  double dN = 1-maxN;
+  rsconf = dN/(dN+1-maxP);
+  csconf = dN/(dN+1-csmaxP);
+}
+
+void EquivalenceChecker::checkCascade(TLD& tld,const Mat& frame,const Rect& roi,const Range& scales){
+  int trees = tld.classifier.getNumStructs();
+  //Blur and pyramid of the whole frame, the fast path only covers the scanned area
+  vector<Mat> pyr(1);
+  GaussianBlur(frame,pyr[0],Size(9,9),1.5);
+  for (int l=1;l<=tld.classifier.maxLevel();l++){
+      pyr.push_back(Mat());
+      pyrDown(pyr[l-1],pyr[l]);
+  }
+  float fern_th = trees*tld.classifier.getFernTh();
+  const TempStruct& tmp = tld.tmp;
+  vector<bool> fern_pass(tmp.var_pass.size(),false);
+  for (size_t k=0;k<tmp.fern_pass.size();k++)
+    fern_pass[tmp.fern_pass[k]] = true;
+  vector<int> code;
+  size_t j = 0;   //var_pass is in window order
+  for (int i=0;i<tld.grid.size();i++){
+      BoundingBox w = tld.grid.window(i);
+      if ((roi.area()>0 && (w & roi)!=w) || (!scales.empty() && (w.sidx<scales.start || w.sidx>=scales.end)))
+        continue;
+      bool fast = j<tmp.var_pass.size() && tmp.var_pass[j]==i;
+      double v = refVar(frame,w);
+      bool ref = v>=tld.var;
+      add(CHECK_VARIANCE,fast!=ref,false,fabs(v-tld.getVar(w,tld.iisum,tld.iisqsum)));
+      if (!fast)
+        continue;
+      if (ref){
+          refFeatures(tld,pyr,w,code);
+          float conf = refForest(tld,code);
+          bool same_code = equal(code.begin(),code.end(),tmp.patt.begin()+j*trees);
+          double delta = fabs(conf-tmp.conf[j]);
+          add(CHECK_FERNS,(conf>fern_th)!=fern_pass[j],!same_code || delta>CONF_TOLERANCE,delta);
+      }
+      j++;
+  }
+}
+
+void EquivalenceChecker::checkNN(TLD& tld){
+  const DetStruct& dt = tld.dt;
+  float nn_th = tld.classifier.getNNTh();
+  for (size_t i=0;i<dt.bb.size();i++){
+      float rs, cs;
+      refNNConf(tld,dt.patch[i],rs,cs);
+      double delta = max(fabs(rs-dt.conf1[i]),fabs(cs-dt.conf2[i]));
+      add(CHECK_NN,(rs>nn_th)!=(dt.conf1[i]>nn_th),delta>CONF_TOLERANCE,delta);
+  }
+}
+
+void EquivalenceChecker::checkTrack(TLD& tld,const Mat& img1,const Mat& img2,float f,const Point2f& offset,
+    const vector<Point2f>& start,const vector<Point2f>& seed,float residual,
+    const vector<Point2f>& tracked1,const vector<Point2f>& tracked2,bool tracked){
+  vector<Point2f> ref1 = start, ref2 = seed;
+  bool ref = !seed.empty() && tracker.trackf2f(img1,img2,ref1,ref2,residual);
+  if (!ref){
+      ref1 = start;
+      ref = tracker.trackf2f(img1,img2,ref1,ref2);
+  }
+  if (!ref || !tracked || ref2.size()!=tracked2.size()){
+      add(CHECK_TRACK,ref!=tracked,ref && tracked,0);
+      return;
+  }
+  for (size_t i=0;i<ref1.size();i++)
+    ref1[i] = ref1[i]*f+offset;
+  for (size_t i=0;i<ref2.size();i++)
+    ref2[i] = ref2[i]*f+offset;
+  double delta = 0;
+  for (size_t i=0;i<ref2.size();i++)
+    delta = max(delta,(double)norm(ref2[i]-tracked2[i]));
+  BoundingBox fast_bb, ref_bb;
+  tld.bbPredict(tracked1,tracked2,tld.lastbox,fast_bb);
+  tld.bbPredict(ref1,ref2,tld.lastbox,ref_bb);
+  int box_delta = max(max(abs(fast_bb.x-ref_bb.x),abs(fast_bb.y-ref_bb.y)),
+                      max(abs(fast_bb.width-ref_bb.width),abs(fast_bb.height-ref_bb.height)));
+  add(CHECK_TRACK,false,box_delta>0 || delta>CONF_TOLERANCE,max(delta,(double)box_delta));
+}
@@ -6,10 +6,14 @@
  */
 
 #include <FerNNClassifier.h>
+#include <tld_log.h>
 
 using namespace cv;
 using namespace std;
 
+FerNNClassifier::FerNNClassifier() : quantized(false),nn_comparisons(0),patch_side(0){
+}
+
 void FerNNClassifier::read(const FileNode& file){
   ///Classifier Parameters
   valid = (float)file["valid"];
@@ -19,6 +23,35 @@ void FerNNClassifier::read(const FileNode& file){
   thr_fern = (float)file["thr_fern"];
   thr_nn = (float)file["thr_nn"];
   thr_nn_valid = (float)file["thr_nn_valid"];
+  setQuantized((int)file["nn_quantized"]!=0);
+}
+
+void FerNNClassifier::setQuantized(bool q){
+  if (q==quantized)
+    return;
+  if (q){
+      if (!pEx.empty())
+        patch_side = pEx[0].rows;
+      pQ.clear();
+      nQ.clear();
+      for (int i=0;i<pEx.size();i++)
+        pQ.push_back(pEx[i]);
+      for (int i=0;i<nEx.size();i++)
+        nQ.push_back(nEx[i]);
+      pEx.clear();
+      nEx.clear();
+  }
+  else {
+      pEx.resize(pQ.size());
+      for (int i=0;i<pQ.size();i++)
+        pEx[i] = pQ.toFloat(i,patch_side);
+      nEx.resize(nQ.size());
+      for (int i=0;i<nQ.size();i++)
+        nEx[i] = nQ.toFloat(i,patch_side);
+      pQ.clear();
+      nQ.clear();
+  }
+  quantized = q;
 }
 
 void FerNNClassifier::prepare(const vector<Size>& scales){
@@ -59,13 +92,45 @@ void FerNNClassifier::getFeatures(const cv::Mat& image,const int& scale_idx, vec
   for (int t=0;t<nstructs;t++){
       leaf=0;
       for (int f=0; f<structSize; f++){
-          leaf = (leaf << 1) + features[scale_idx][t*nstructs+f](image);
+          leaf = (leaf << 1) + features[scale_idx][t*structSize+f](image);
+      }
+      fern[t]=leaf;
+  }
+}
+
+void FerNNClassifier::setLevels(const vector<int>& scale_levels){
+  levels = scale_levels;
+  level_features.assign(features.size(),vector<Feature>());
+  for (size_t s=0;s<levels.size() && s<features.size();s++){
+      //Same pixel pairs, 2^l times closer
+      int l = levels[s];
+      level_features[s].resize(features[s].size());
+      for (size_t i=0;i<features[s].size();i++){
+          const Feature& f = features[s][i];
+          level_features[s][i] = Feature(f.x1>>l,f.y1>>l,f.x2>>l,f.y2>>l);
+      }
+  }
+}
+
+int FerNNClassifier::maxLevel() const {
+  int l = 0;
+  for (size_t s=0;s<levels.size();s++)
+    l = max(l,levels[s]);
+  return l;
+}
+
+void FerNNClassifier::getLevelFeatures(const cv::Mat& image,const int& scale_idx, vector<int>& fern){
+  int leaf;
+  for (int t=0;t<nstructs;t++){
+      leaf=0;
+      for (int f=0; f<structSize; f++){
+          leaf = (leaf << 1) + level_features[scale_idx][t*structSize+f](image);
       }
       fern[t]=leaf;
   }
 }
 
-float FerNNClassifier::measure_forest(vector<int> fern) {
+float FerNNClassifier::measure_forest(const int* fern) {
   float votes = 0;
   for (int i = 0; i < nstructs; i++) {
       votes += posteriors[i][fern[i]];
@@ -73,7 +138,7 @@ float FerNNClassifier::measure_forest(vector<int> fern) {
   return votes;
 }
 
-void FerNNClassifier::update(const vector<int>& fern, int C, int N) {
+void FerNNClassifier::update(const int* fern, int C, int N) {
   int idx;
   for (int i = 0; i < nstructs; i++) {
       idx = fern[i];
@@ -86,7 +151,7 @@ void FerNNClassifier::update(const vector<int>& fern, int C, int N) {
   }
 }
 
-void FerNNClassifier::trainF(const vector<std::pair<vector<int>,int> >& ferns,int resample){
+void FerNNClassifier::trainF(const FernTrainingSet& ferns,int resample){
   // Conf = function(2,X,Y,Margin,Bootstrap,Idx)
   //                 0 1 2 3      4         5
   //  double *X     = mxGetPr(prhs[1]); -> ferns[i].first
@@ -99,13 +164,13 @@ void FerNNClassifier::trainF(const vector<std::pair<vector<int>,int> >& ferns,in
       for (int i = 0; i < ferns.size(); i++){               //   for (int i = 0; i < step; i++) {
                                                             //     for (int k = 0; k < 10; k++) {
                                                             //       int I = k*step + i;//box index
-                                                            //       double *x = X+nTREES*I; //tree index
-          if(ferns[i].second==1){                           //       if (Y[I] == 1) {
-              if(measure_forest(ferns[i].first)<=thrP)      //         if (measure_forest(x) <= thrP)
-                update(ferns[i].first,1,1);                 //             update(x,1,1);
+          const int* x = ferns.code(i);                     //       double *x = X+nTREES*I; //tree index
+          if(ferns.label(i)==1){                            //       if (Y[I] == 1) {
+              if(measure_forest(x)<=thrP)                   //         if (measure_forest(x) <= thrP)
+                update(x,1,1);                              //             update(x,1,1);
           }else{                                            //        }else{
-              if (measure_forest(ferns[i].first) >= thrN)   //         if (measure_forest(x) >= thrN)
-                update(ferns[i].first,0,1);                 //             update(x,0,1);
+              if (measure_forest(x)>=thrN)                  //         if (measure_forest(x) >= thrN)
+                update(x,0,1);                              //             update(x,0,1);
           }
       }
   //}
@@ -117,21 +182,33 @@ void FerNNClassifier::trainNN(const vector<cv::Mat>& nn_examples){
   y[0]=1;
   vector<int> isin;
   for (int i=0;i<nn_examples.size();i++){                          //  For each example
+      patch_side = nn_examples[i].rows;
       NNConf(nn_examples[i],isin,conf,dummy);                      //  Measure Relative similarity
       if (y[i]==1 && conf<=thr_nn){                                //    if y(i) == 1 && conf1 <= tld.model.thr_nn % 0.65
           if (isin[1]<0){                                          //      if isnan(isin(2))
-              pEx = vector<Mat>(1,nn_examples[i]);                 //        tld.pex = x(:,i);
+              if (quantized){
+                  pQ.clear();
+                  pQ.push_back(nn_examples[i]);
+              }
+              else
+                pEx = vector<Mat>(1,nn_examples[i]);               //        tld.pex = x(:,i);
               continue;                                            //        continue;
           }                                                        //      end
           //pEx.insert(pEx.begin()+isin[1],nn_examples[i]);        //      tld.pex = [tld.pex(:,1:isin(2)) x(:,i) tld.pex(:,isin(2)+1:end)]; % add to model
-          pEx.push_back(nn_examples[i]);
+          if (quantized)
+            pQ.push_back(nn_examples[i]);
+          else
+            pEx.push_back(nn_examples[i]);
       }                                                            //    end
-      if(y[i]==0 && conf>0.5)                                      //  if y(i) == 0 && conf1 > 0.5
-        nEx.push_back(nn_examples[i]);                             //    tld.nex = [tld.nex x(:,i)];
-
+      if(y[i]==0 && conf>0.5){                                     //  if y(i) == 0 && conf1 > 0.5
+          if (quantized)
+            nQ.push_back(nn_examples[i]);
+          else
+            nEx.push_back(nn_examples[i]);                         //    tld.nex = [tld.nex x(:,i)];
+      }
   }                                                                 //  end
   acum++;
-  printf("%d. Trained NN examples: %d positive %d negative\n",acum,(int)pEx.size(),(int)nEx.size());
+  TLD_DEBUG("%d. Trained NN examples: %d positive %d negative",acum,numPositive(),numNegative());
 }                                                                  //  end
 
 
@@ -142,25 +219,39 @@ void FerNNClassifier::NNConf(const Mat& example, vector<int>& isin,float& rsconf
    * -Relative Similarity (rsconf), Conservative Similarity (csconf), In pos. set|Id pos set|In neg. set (isin)
    */
   isin=vector<int>(3,-1);
-  if (pEx.empty()){ //if isempty(tld.pex) % IF positive examples in the model are not defined THEN everything is negative
+  int num_pex = numPositive();
+  int num_nex = numNegative();
+  if (num_pex==0){ //if isempty(tld.pex) % IF positive examples in the model are not defined THEN everything is negative
       rsconf = 0; //    conf1 = zeros(1,size(x,2));
       csconf=0;
       return;
   }
-  if (nEx.empty()){ //if isempty(tld.nex) % IF negative examples in the model are not defined THEN everything is positive
+  if (num_nex==0){ //if isempty(tld.nex) % IF negative examples in the model are not defined THEN everything is positive
       rsconf = 1;   //    conf1 = ones(1,size(x,2));
       csconf=1;
       return;
   }
+  nn_comparisons += num_pex+num_nex;
   Mat ncc(1,1,CV_32F);
   float nccP,csmaxP,maxP=0;
   bool anyP=false;
-  int maxPidx,validatedPart = ceil(pEx.size()*valid);
+  int maxPidx,validatedPart = ceil(num_pex*valid);
   float nccN, maxN=0;
   bool anyN=false;
-  for (int i=0;i<pEx.size();i++){
-      matchTemplate(pEx[i],example,ncc,CV_TM_CCORR_NORMED);      // measure NCC to positive examples
-      nccP=(((float*)ncc.data)[0]+1)*0.5;
+  //Quantized mode: the query is quantized once, correlations are integer dot products
+  static thread_local vector<int8_t> query;
+  float qnorm, qscale;
+  if (quantized){
+      query.resize(pQ.getStride());
+      QuantizedPatches::quantize(example,query.size(),&query[0],qscale,qnorm);
+  }
+  for (int i=0;i<num_pex;i++){
+      if (quantized)
+        nccP=(pQ.ncc(i,&query[0],qnorm)+1)*0.5;
+      else {
+          matchTemplate(pEx[i],example,ncc,CV_TM_CCORR_NORMED);  // measure NCC to positive examples
+          nccP=(((float*)ncc.data)[0]+1)*0.5;
+      }
       if (nccP>ncc_thesame)
         anyP=true;
       if(nccP > maxP){
@@ -170,9 +261,13 @@ void FerNNClassifier::NNConf(const Mat& example, vector<int>& isin,float& rsconf
             csmaxP=maxP;
       }
   }
-  for (int i=0;i<nEx.size();i++){
-      matchTemplate(nEx[i],example,ncc,CV_TM_CCORR_NORMED);     //measure NCC to negative examples
-      nccN=(((float*)ncc.data)[0]+1)*0.5;
+  for (int i=0;i<num_nex;i++){
+      if (quantized)
+        nccN=(nQ.ncc(i,&query[0],qnorm)+1)*0.5;
+      else {
+          matchTemplate(nEx[i],example,ncc,CV_TM_CCORR_NORMED); //measure NCC to negative examples
+          nccN=(((float*)ncc.data)[0]+1)*0.5;
+      }
       if (nccN>ncc_thesame)
         anyN=true;
       if(nccN > maxN)
@@ -191,10 +286,10 @@ void FerNNClassifier::NNConf(const Mat& example, vector<int>& isin,float& rsconf
   csconf =(float)dN / (dN + dP);
 }
 
-void FerNNClassifier::evaluateTh(const vector<pair<vector<int>,int> >& nXT,const vector<cv::Mat>& nExT){
+void FerNNClassifier::evaluateTh(const FernTrainingSet& nXT,const vector<cv::Mat>& nExT){
 float fconf;
   for (int i=0;i<nXT.size();i++){
-    fconf = (float) measure_forest(nXT[i].first)/nstructs;
+    fconf = (float) measure_forest(nXT.code(i))/nstructs;
     if (fconf>thr_fern)
       thr_fern=fconf;
 }
@@ -210,15 +305,158 @@ float fconf;
 }
 
 void FerNNClassifier::show(){
-  Mat examples((int)pEx.size()*pEx[0].rows,pEx[0].cols,CV_8U);
+  Mat first = positive(0);
+  Mat examples(numPositive()*first.rows,first.cols,CV_8U);
   double minval;
-  Mat ex(pEx[0].rows,pEx[0].cols,pEx[0].type());
-  for (int i=0;i<pEx.size();i++){
-    minMaxLoc(pEx[i],&minval);
-    pEx[i].copyTo(ex);
+  Mat ex(first.rows,first.cols,first.type());
+  for (int i=0;i<numPositive();i++){
+    Mat p = positive(i);
+    minMaxLoc(p,&minval);
+    p.copyTo(ex);
     ex = ex-minval;
-    Mat tmp = examples.rowRange(Range(i*pEx[i].rows,(i+1)*pEx[i].rows));
+    Mat tmp = examples.rowRange(Range(i*p.rows,(i+1)*p.rows));
     ex.convertTo(tmp,CV_8U);
   }
   imshow("Examples",examples);
 }
+
+void FerNNClassifier::saveState(ModelHeader& header,ModelWriter& writer){
+  header.num_trees = nstructs;
+  header.num_features = structSize;
+  header.acum = acum;
+  header.thr_fern = thr_fern;
+  header.thr_nn = thr_nn;
+  header.thr_nn_valid = thr_nn_valid;
+  header.thrN = thrN;
+  header.thrP = thrP;
+  header.valid = valid;
+  header.ncc_thesame = ncc_thesame;
+  //Ferns
+  vector<Feature> flat_features;
+  for (int s=0;s<features.size();s++)
+    flat_features.insert(flat_features.end(),features[s].begin(),features[s].end());
+  header.features = writer.append(flat_features.empty() ? NULL : &flat_features[0],flat_features.size()*sizeof(Feature));
+  int leaves = nstructs>0 ? (int)posteriors[0].size() : 0;
+  vector<float> flat_posteriors(nstructs*leaves);
+  vector<int> flat_p(nstructs*leaves);
+  vector<int> flat_n(nstructs*leaves);
+  for (int i=0;i<nstructs;i++){
+      copy(posteriors[i].begin(),posteriors[i].end(),flat_posteriors.begin()+i*leaves);
+      copy(pCounter[i].begin(),pCounter[i].end(),flat_p.begin()+i*leaves);
+      copy(nCounter[i].begin(),nCounter[i].end(),flat_n.begin()+i*leaves);
+  }
+  header.posteriors = writer.append(&flat_posteriors[0],flat_posteriors.size()*sizeof(float));
+  header.pcounter = writer.append(&flat_p[0],flat_p.size()*sizeof(int));
+  header.ncounter = writer.append(&flat_n[0],flat_n.size()*sizeof(int));
+  //NN examples, one patch after the other
+  header.num_pex = numPositive();
+  header.num_nex = numNegative();
+  if (quantized){
+      header.nn_quantized = 1;
+      header.nn_stride = pQ.getStride();
+      header.pex_q = writer.append(pQ.empty() ? NULL : pQ.patch(0),(uint64_t)pQ.size()*pQ.getStride());
+      header.nex_q = writer.append(nQ.empty() ? NULL : nQ.patch(0),(uint64_t)nQ.size()*nQ.getStride());
+      vector<float> info;
+      for (int i=0;i<pQ.size();i++)
+        info.push_back(pQ.scale(i));
+      for (int i=0;i<pQ.size();i++)
+        info.push_back(pQ.norm(i));
+      header.pex_qinfo = writer.append(info.empty() ? NULL : &info[0],info.size()*sizeof(float));
+      info.clear();
+      for (int i=0;i<nQ.size();i++)
+        info.push_back(nQ.scale(i));
+      for (int i=0;i<nQ.size();i++)
+        info.push_back(nQ.norm(i));
+      header.nex_qinfo = writer.append(info.empty() ? NULL : &info[0],info.size()*sizeof(float));
+      return;
+  }
+  int patch_bytes = header.patch_size*header.patch_size*sizeof(float);
+  vector<float> flat;
+  for (int i=0;i<pEx.size();i++){
+      Mat p = pEx[i].isContinuous() ? pEx[i] : pEx[i].clone();
+      flat.insert(flat.end(),(const float*)p.data,(const float*)(p.data+patch_bytes));
+  }
+  header.pex = writer.append(flat.empty() ? NULL : &flat[0],flat.size()*sizeof(float));
+  flat.clear();
+  for (int i=0;i<nEx.size();i++){
+      Mat p = nEx[i].isContinuous() ? nEx[i] : nEx[i].clone();
+      flat.insert(flat.end(),(const float*)p.data,(const float*)(p.data+patch_bytes));
+  }
+  header.nex = writer.append(flat.empty() ? NULL : &flat[0],flat.size()*sizeof(float));
+}
+
+bool FerNNClassifier::loadState(const ModelHeader& header,const shared_ptr<MappedFile>& file){
+  int leaves = 1 << header.num_features;
+  int total_features = header.num_trees*header.num_features;
+  int patch_bytes = header.patch_size*header.patch_size*sizeof(float);
+  int stride = header.nn_stride;
+  bool examples_ok = header.nn_quantized ?
+      stride==QuantizedPatches::strideFor(header.patch_size*header.patch_size) &&
+      file->contains(header.pex_q,(uint64_t)header.num_pex*stride) &&
+      file->contains(header.pex_qinfo,(uint64_t)header.num_pex*2*sizeof(float)) &&
+      file->contains(header.nex_q,(uint64_t)header.num_nex*stride) &&
+      file->contains(header.nex_qinfo,(uint64_t)header.num_nex*2*sizeof(float)) :
+      file->contains(header.pex,(uint64_t)header.num_pex*patch_bytes) &&
+      file->contains(header.nex,(uint64_t)header.num_nex*patch_bytes);
+  if (!examples_ok || header.num_trees<=0 || header.num_features<=0 || header.num_features>24 ||
+      !file->contains(header.features,(uint64_t)header.num_scales*total_features*sizeof(Feature)) ||
+      !file->contains(header.posteriors,(uint64_t)header.num_trees*leaves*sizeof(float)) ||
+      !file->contains(header.pcounter,(uint64_t)header.num_trees*leaves*sizeof(int)) ||
+      !file->contains(header.ncounter,(uint64_t)header.num_trees*leaves*sizeof(int)))
+    return false;
+  nstructs = header.num_trees;
+  structSize = header.num_features;
+  acum = header.acum;
+  thr_fern = header.thr_fern;
+  thr_nn = header.thr_nn;
+  thr_nn_valid = header.thr_nn_valid;
+  thrN = header.thrN;
+  thrP = header.thrP;
+  valid = header.valid;
+  ncc_thesame = header.ncc_thesame;
+  //Mutable tables are copied out of the mapping
+  const Feature* f = (const Feature*)file->section(header.features);
+  features.assign(header.num_scales,vector<Feature>());
+  for (int s=0;s<header.num_scales;s++)
+    features[s].assign(f+s*total_features,f+(s+1)*total_features);
+  const float* post = (const float*)file->section(header.posteriors);
+  const int* pc = (const int*)file->section(header.pcounter);
+  const int* nc = (const int*)file->section(header.ncounter);
+  posteriors.assign(nstructs,vector<float>());
+  pCounter.assign(nstructs,vector<int>());
+  nCounter.assign(nstructs,vector<int>());
+  for (int i=0;i<nstructs;i++){
+      posteriors[i].assign(post+i*leaves,post+(i+1)*leaves);
+      pCounter[i].assign(pc+i*leaves,pc+(i+1)*leaves);
+      nCounter[i].assign(nc+i*leaves,nc+(i+1)*leaves);
+  }
+  patch_side = header.patch_size;
+  if (header.nn_quantized){
+      //Quantized examples are copied, the stored mode is converted to the configured one
+      bool q = quantized;
+      quantized = true;
+      const float* info = (const float*)file->section(header.pex_qinfo);
+      pQ.assign(stride,(const int8_t*)file->section(header.pex_q),info,info+header.num_pex,header.num_pex);
+      info = (const float*)file->section(header.nex_qinfo);
+      nQ.assign(stride,(const int8_t*)file->section(header.nex_q),info,info+header.num_nex,header.num_nex);
+      pEx.clear();
+      nEx.clear();
+      setQuantized(q);
+      return true;
+  }
+  //Examples are never modified in place, they point into the mapping
+  model_file = file;
+  const char* p = (const char*)file->section(header.pex);
+  pEx.resize(header.num_pex);
+  for (int i=0;i<header.num_pex;i++)
+    pEx[i] = Mat(header.patch_size,header.patch_size,CV_32F,(void*)(p+i*patch_bytes));
+  p = (const char*)file->section(header.nex);
+  nEx.resize(header.num_nex);
+  for (int i=0;i<header.num_nex;i++)
+    nEx[i] = Mat(header.patch_size,header.patch_size,CV_32F,(void*)(p+i*patch_bytes));
+  if (quantized){
+      quantized = false;
+      setQuantized(true);
+  }
+  return true;
+}
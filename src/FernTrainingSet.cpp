@@ -0,0 +1,36 @@
+/*
+ * FernTrainingSet.cpp
+ */
+
+#include <FernTrainingSet.h>
+#include <tld_utils.h>
+#include <algorithm>
+using namespace std;
+
+void FernTrainingSet::reset(int num_trees){
+  trees = num_trees;
+  codes.clear();
+  labels.clear();
+}
+
+void FernTrainingSet::add(const int* code,int label){
+  codes.insert(codes.end(),code,code+trees);
+  labels.push_back(label);
+}
+
+void FernTrainingSet::append(const FernTrainingSet& other){
+  codes.insert(codes.end(),other.codes.begin(),other.codes.end());
+  labels.insert(labels.end(),other.labels.begin(),other.labels.end());
+}
+
+void FernTrainingSet::shuffle(){
+  vector<int> order = index_shuffle(0,size());
+  vector<int> c(codes.size()), l(labels.size());
+  for (int i=0;i<size();i++){
+      int o = order[i];
+      copy(codes.begin()+(size_t)o*trees,codes.begin()+(size_t)(o+1)*trees,c.begin()+(size_t)i*trees);
+      l[i] = labels[o];
+  }
+  codes.swap(c);
+  labels.swap(l);
+}
@@ -0,0 +1,221 @@
+/*
+ * FrameSource.cpp
+ */
+
+#include <FrameSource.h>
+#include <tld_log.h>
+#include <string.h>
+#include <sys/stat.h>
+using namespace cv;
+using namespace std;
+
+static bool sourceStat(const string& path,uint64_t& size,int64_t& mtime){
+  struct stat st;
+  if (stat(path.c_str(),&st)!=0)
+    return false;
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+FrameSource::FrameSource()
+: current(0),mapped(NULL),header(NULL),next(0),writing(NULL),write_pos(0),write_failed(false){
+}
+
+FrameSource::~FrameSource(){
+  close();
+}
+
+void FrameSource::close(){
+  abortCache();
+  capture.release();
+  frames.clear();
+  delete mapped;
+  mapped = NULL;
+  header = NULL;
+}
+
+bool FrameSource::open(const string& video_path,const string& cache){
+  close();
+  video = video_path;
+  cache_path = cache;
+  write_failed = false;
+  if (!cache_path.empty() && openCache()){
+      TLD_INFO("Reading %d frames from cache %s",(int)frames.size(),cache_path.c_str());
+      return true;
+  }
+  return capture.open(video);
+}
+
+bool FrameSource::open(int device){
+  close();
+  video.clear();
+  cache_path.clear();
+  return capture.open(device);
+}
+
+bool FrameSource::isOpened() const {
+  return mapped!=NULL || capture.isOpened();
+}
+
+bool FrameSource::set(int prop,double value){
+  return capture.set(prop,value);
+}
+
+bool FrameSource::openCache(){
+  MappedFile* file = new MappedFile;
+  const FrameCacheHeader* h = NULL;
+  uint64_t size;
+  int64_t mtime;
+  bool ok = file->open(cache_path) && file->size()>=sizeof(FrameCacheHeader) && sourceStat(video,size,mtime);
+  if (ok){
+      h = (const FrameCacheHeader*)file->data();
+      ok = memcmp(h->magic,FRAME_CACHE_MAGIC,sizeof(h->magic))==0 && h->version==FRAME_CACHE_VERSION &&
+          h->endian==MODEL_ENDIAN && h->header_size==sizeof(FrameCacheHeader) &&
+          h->source_size==size && h->source_mtime==mtime &&
+          file->contains(h->index,(uint64_t)h->num_frames*sizeof(uint64_t));
+  }
+  if (!ok){
+      delete file;
+      return false;
+  }
+  const uint64_t* index = (const uint64_t*)file->section(h->index);
+  uint64_t frame_bytes = (uint64_t)h->step*h->height;
+  frames.resize(h->num_frames);
+  for (int i=0;i<h->num_frames;i++){
+      if (index[i]>file->size() || frame_bytes>file->size()-index[i]){
+          frames.clear();
+          delete file;
+          return false;
+      }
+      frames[i] = Mat(h->height,h->width,CV_8U,(void*)(file->data()+index[i]),h->step);
+  }
+  mapped = file;
+  header = h;
+  next = 0;
+  return true;
+}
+
+bool FrameSource::read(Mat& gray,Mat* color){
+  if (mapped){
+      if (next>=frames.size())
+        return false;
+      gray = frames[next++];
+      if (color)
+        cvtColor(gray,*color,CV_GRAY2BGR);
+      return true;
+  }
+  if (!capture.read(color_frame)){
+      finishCache();
+      return false;
+  }
+  current = 1-current;
+  cvtColor(color_frame,gray_buffers[current],CV_RGB2GRAY);
+  gray = gray_buffers[current];
+  if (color)
+    *color = color_frame;
+  if (!cache_path.empty() && !write_failed){
+      if (!writing)
+        startCache(gray);
+      appendCache(gray);
+  }
+  return true;
+}
+
+bool FrameSource::rewind(){
+  if (video.empty())
+    return false;
+  if (!mapped){
+      abortCache(); //an incomplete pass never becomes a cache
+      capture.release();
+      if (!cache_path.empty() && openCache()){
+          TLD_INFO("Replaying %d frames from cache %s",(int)frames.size(),cache_path.c_str());
+          return true;
+      }
+      return capture.open(video);
+  }
+  next = 0;
+  return true;
+}
+
+void FrameSource::startCache(const Mat& gray){
+  writing = fopen((cache_path+".tmp").c_str(),"wb");
+  if (!writing){
+      TLD_WARN("Could not create frame cache %s",cache_path.c_str());
+      write_failed = true;
+      return;
+  }
+  FrameCacheHeader placeholder;
+  memset(&placeholder,0,sizeof(placeholder));
+  write_failed = fwrite(&placeholder,sizeof(placeholder),1,writing)!=1;
+  write_pos = sizeof(placeholder);
+  write_size = gray.size();
+  offsets.clear();
+}
+
+void FrameSource::appendCache(const Mat& gray){
+  if (!writing)
+    return;
+  if (gray.size()!=write_size){
+      TLD_WARN("Frame size changed, not caching %s",video.c_str());
+      abortCache();
+      write_failed = true;
+      return;
+  }
+  static const char zeros[MODEL_ALIGN] = {0};
+  uint64_t pad = (MODEL_ALIGN - write_pos%MODEL_ALIGN)%MODEL_ALIGN;
+  if (pad>0 && fwrite(zeros,1,pad,writing)!=pad)
+    write_failed = true;
+  write_pos += pad;
+  offsets.push_back(write_pos);
+  for (int y=0;y<gray.rows;y++){
+      if (fwrite(gray.ptr(y),1,gray.cols,writing)!=(size_t)gray.cols)
+        write_failed = true;
+  }
+  write_pos += (uint64_t)gray.rows*gray.cols;
+}
+
+void FrameSource::finishCache(){
+  if (!writing)
+    return;
+  FrameCacheHeader h;
+  memset(&h,0,sizeof(h));
+  memcpy(h.magic,FRAME_CACHE_MAGIC,sizeof(h.magic));
+  h.version = FRAME_CACHE_VERSION;
+  h.endian = MODEL_ENDIAN;
+  h.header_size = sizeof(FrameCacheHeader);
+  h.width = write_size.width;
+  h.height = write_size.height;
+  h.step = write_size.width;
+  h.num_frames = offsets.size();
+  if (!sourceStat(video,h.source_size,h.source_mtime))
+    write_failed = true;
+  static const char zeros[MODEL_ALIGN] = {0};
+  uint64_t pad = (MODEL_ALIGN - write_pos%MODEL_ALIGN)%MODEL_ALIGN;
+  if (pad>0 && fwrite(zeros,1,pad,writing)!=pad)
+    write_failed = true;
+  h.index.offset = write_pos+pad;
+  h.index.bytes = offsets.size()*sizeof(uint64_t);
+  if (!offsets.empty() && fwrite(&offsets[0],sizeof(uint64_t),offsets.size(),writing)!=offsets.size())
+    write_failed = true;
+  if (fseek(writing,0,SEEK_SET)!=0 || fwrite(&h,sizeof(h),1,writing)!=1)
+    write_failed = true;
+  if (fclose(writing)!=0)
+    write_failed = true;
+  writing = NULL;
+  string tmp = cache_path+".tmp";
+  if (write_failed || rename(tmp.c_str(),cache_path.c_str())!=0){
+      TLD_WARN("Could not write frame cache %s",cache_path.c_str());
+      remove(tmp.c_str());
+      return;
+  }
+  TLD_INFO("Cached %d frames in %s",(int)offsets.size(),cache_path.c_str());
+}
+
+void FrameSource::abortCache(){
+  if (!writing)
+    return;
+  fclose(writing);
+  writing = NULL;
+  remove((cache_path+".tmp").c_str());
+}
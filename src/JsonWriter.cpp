@@ -0,0 +1,108 @@
+/*
+ * JsonWriter.cpp
+ */
+
+#include <JsonWriter.h>
+#include <math.h>
+using namespace std;
+
+JsonWriter::JsonWriter(FILE* f)
+: file(f),after_key(false){
+}
+
+void JsonWriter::indent(){
+  fputc('\n',file);
+  for (size_t i=0;i<first.size();i++)
+    fputs("  ",file);
+}
+
+//Comma and newline before every container element, nothing after a key
+void JsonWriter::separate(){
+  if (after_key){
+      after_key = false;
+      return;
+  }
+  if (first.empty())
+    return;
+  if (!first.back())
+    fputc(',',file);
+  first.back() = false;
+  indent();
+}
+
+void JsonWriter::beginObject(){
+  separate();
+  fputc('{',file);
+  first.push_back(true);
+}
+
+void JsonWriter::endObject(){
+  bool empty = first.back();
+  first.pop_back();
+  if (!empty)
+    indent();
+  fputc('}',file);
+  if (first.empty())
+    fputc('\n',file);
+}
+
+void JsonWriter::beginArray(){
+  separate();
+  fputc('[',file);
+  first.push_back(true);
+}
+
+void JsonWriter::endArray(){
+  bool empty = first.back();
+  first.pop_back();
+  if (!empty)
+    indent();
+  fputc(']',file);
+}
+
+JsonWriter& JsonWriter::key(const std::string& name){
+  separate();
+  writeString(name);
+  fputs(": ",file);
+  after_key = true;
+  return *this;
+}
+
+void JsonWriter::value(double v){
+  separate();
+  if (isfinite(v))
+    fprintf(file,"%.6g",v);
+  else
+    fputs("null",file);
+}
+
+void JsonWriter::value(int v){
+  separate();
+  fprintf(file,"%d",v);
+}
+
+void JsonWriter::value(bool v){
+  separate();
+  fputs(v ? "true" : "false",file);
+}
+
+void JsonWriter::value(const std::string& v){
+  separate();
+  writeString(v);
+}
+
+void JsonWriter::writeString(const std::string& s){
+  fputc('"',file);
+  for (size_t i=0;i<s.size();i++){
+      unsigned char c = s[i];
+      if (c=='"' || c=='\\'){
+          fputc('\\',file);
+          fputc(c,file);
+      }
+      else if (c<0x20)
+        fprintf(file,"\\u%04x",c);
+      else
+        fputc(c,file);
+  }
+  fputc('"',file);
+}
@@ -1,7 +1,10 @@
 #include <LKTracker.h>
 using namespace cv;
 
+static Profiler no_profiler(false);
+
 LKTracker::LKTracker(){
+  prof = &no_profiler;
   term_criteria = TermCriteria( TermCriteria::COUNT+TermCriteria::EPS, 20, 0.03);
   window_size = Size(4,4);
   level = 5;
@@ -10,16 +13,55 @@ LKTracker::LKTracker(){
 
 
 bool LKTracker::trackf2f(const Mat& img1, const Mat& img2,vector<Point2f> &points1, vector<cv::Point2f> &points2){
+  return track(img1,img2,points1,points2,level,term_criteria,0);
+}
+
+int LKTracker::levelsFor(float residual) const {
+  //Each level doubles the displacement the window can recover
+  int levels = 0;
+  for (float reach=window_size.width*0.5f;reach<residual && levels<level;reach*=2)
+    levels++;
+  return levels;
+}
+
+bool LKTracker::trackf2f(const Mat& img1, const Mat& img2,vector<Point2f> &points1, vector<cv::Point2f> &points2,float residual){
+  int levels = levelsFor(residual);
+  //Fewer iterations per level from a close start, the full count at full depth
+  TermCriteria term(TermCriteria::COUNT+TermCriteria::EPS,
+                    term_criteria.maxCount*(levels+5)/(level+5),term_criteria.epsilon);
+  return track(img1,img2,points1,points2,levels,term,OPTFLOW_USE_INITIAL_FLOW);
+}
+
+bool LKTracker::track(const Mat& img1,const Mat& img2,vector<Point2f>& points1,vector<Point2f>& points2,
+                      int levels,const TermCriteria& term,int flags){
   //TODO!:implement c function cvCalcOpticalFlowPyrLK() or Faster tracking function
   //Forward-Backward tracking
-  calcOpticalFlowPyrLK( img1,img2, points1, points2, status,similarity, window_size, level, term_criteria, lambda, 0);
-  calcOpticalFlowPyrLK( img2,img1, points2, pointsFB, FB_status,FB_error, window_size, level, term_criteria, lambda, 0);
+  if (flags & OPTFLOW_USE_INITIAL_FLOW){
+      guess.resize(points1.size());
+      for (size_t i=0;i<points1.size();i++)
+        guess[i] = points2[i]-points1[i];
+  }
+  prof->begin(PROF_LK_FORWARD);
+  calcOpticalFlowPyrLK( img1,img2, points1, points2, status,similarity, window_size, levels, term, lambda, flags);
+  prof->end(PROF_LK_FORWARD);
+  prof->begin(PROF_LK_BACKWARD);
+  //The backward pass starts from the predicted motion reversed, not from points1
+  if (flags & OPTFLOW_USE_INITIAL_FLOW){
+      pointsFB.resize(points2.size());
+      for (size_t i=0;i<points2.size();i++)
+        pointsFB[i] = points2[i]-guess[i];
+  }
+  calcOpticalFlowPyrLK( img2,img1, points2, pointsFB, FB_status,FB_error, window_size, levels, term, lambda, flags);
   //Compute the real FB-error
   for( int i= 0; i<points1.size(); ++i ){
         FB_error[i] = norm(pointsFB[i]-points1[i]);
   }
+  prof->end(PROF_LK_BACKWARD);
   //Filter out points with FB_error[i] > median(FB_error) && points with sim_error[i] > median(sim_error)
+  prof->begin(PROF_NCC);
   normCrossCorrelation(img1,img2,points1,points2);
+  prof->end(PROF_NCC);
+  ProfScope scope(*prof,PROF_FILTER);
   return filterPts(points1,points2);
 }
 
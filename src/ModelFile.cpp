@@ -0,0 +1,99 @@
+/*
+ * ModelFile.cpp
+ */
+
+#include <ModelFile.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+void initModelHeader(ModelHeader& header){
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,MODEL_MAGIC,sizeof(header.magic));
+  header.version = MODEL_VERSION;
+  header.endian = MODEL_ENDIAN;
+  header.header_size = sizeof(ModelHeader);
+}
+
+ModelWriter::~ModelWriter(){
+  if (file)
+    fclose(file);
+}
+
+bool ModelWriter::open(const string& path){
+  file = fopen(path.c_str(),"wb");
+  if (!file)
+    return false;
+  failed = false;
+  ModelHeader placeholder;
+  memset(&placeholder,0,sizeof(placeholder));
+  pos = 0;
+  append(&placeholder,sizeof(placeholder));
+  return !failed;
+}
+
+ModelSection ModelWriter::append(const void* data,uint64_t bytes){
+  static const char zeros[MODEL_ALIGN] = {0};
+  uint64_t pad = (MODEL_ALIGN - pos%MODEL_ALIGN)%MODEL_ALIGN;
+  if (pad>0 && fwrite(zeros,1,pad,file)!=pad)
+    failed = true;
+  pos += pad;
+  ModelSection s;
+  s.offset = pos;
+  s.bytes = bytes;
+  if (bytes>0 && fwrite(data,1,bytes,file)!=bytes)
+    failed = true;
+  pos += bytes;
+  return s;
+}
+
+bool ModelWriter::finish(ModelHeader& header){
+  if (fseek(file,0,SEEK_SET)!=0 || fwrite(&header,sizeof(header),1,file)!=1)
+    failed = true;
+  if (fclose(file)!=0)
+    failed = true;
+  file = NULL;
+  return !failed;
+}
+
+MappedFile::~MappedFile(){
+  if (addr)
+    munmap(addr,len);
+}
+
+bool MappedFile::open(const string& path){
+  int fd = ::open(path.c_str(),O_RDONLY);
+  if (fd<0)
+    return false;
+  struct stat st;
+  if (fstat(fd,&st)!=0 || st.st_size==0){
+      close(fd);
+      return false;
+  }
+  len = st.st_size;
+  addr = mmap(NULL,len,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (addr==MAP_FAILED){
+      addr = NULL;
+      len = 0;
+      return false;
+  }
+  return true;
+}
+
+bool MappedFile::contains(const ModelSection& s,uint64_t bytes) const {
+  return s.bytes==bytes && s.offset%MODEL_ALIGN==0 && s.offset<=len && s.bytes<=len-s.offset;
+}
+
+bool checkModelHeader(const MappedFile& file,const ModelHeader*& header){
+  if (file.size()<sizeof(ModelHeader))
+    return false;
+  header = (const ModelHeader*)file.data();
+  return memcmp(header->magic,MODEL_MAGIC,sizeof(header->magic))==0 &&
+      header->version==MODEL_VERSION &&
+      header->endian==MODEL_ENDIAN &&
+      header->header_size==sizeof(ModelHeader);
+}
@@ -0,0 +1,54 @@
+/*
+ * MotionModel.cpp
+ */
+
+#include <MotionModel.h>
+#include <math.h>
+using namespace cv;
+using namespace std;
+
+void MotionModel::reset(){
+  frames = 0;
+  center = Point2f(0,0);
+  side = 0;
+  velocity = Point2f(0,0);
+  growth = 1;
+  error = 0;
+}
+
+void MotionModel::observe(const Rect& box){
+  Point2f c(box.x+box.width*0.5f,box.y+box.height*0.5f);
+  float s = sqrt((float)box.area());
+  if (frames>0 && side>0){
+      Point2f v = c-center;
+      float g = s/side;
+      if (frames>=2){
+          //Error of the prediction made for this frame
+          Point2f d = v-velocity;
+          float e = sqrt(d.x*d.x+d.y*d.y)+fabs(side*(g-growth));
+          error = frames>2 ? 0.7f*error+0.3f*e : e;
+          velocity = 0.5f*(velocity+v);
+          growth = 0.5f*(growth+g);
+      }
+      else{
+          velocity = v;
+          growth = g;
+      }
+  }
+  center = c;
+  side = s;
+  frames++;
+}
+
+float MotionModel::uncertainty() const {
+  //Twice the usual error, plus a share of the speed for sudden stops and turns
+  return 2*error+0.25f*sqrt(velocity.x*velocity.x+velocity.y*velocity.y)+1;
+}
+
+void MotionModel::predict(const Rect& box,const vector<Point2f>& points,vector<Point2f>& predicted) const {
+  Point2f c(box.x+box.width*0.5f,box.y+box.height*0.5f);
+  Point2f next = c+velocity;
+  predicted.resize(points.size());
+  for (size_t i=0;i<points.size();i++)
+    predicted[i] = next+growth*(points[i]-c);
+}
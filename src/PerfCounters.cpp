@@ -0,0 +1,103 @@
+/*
+ * PerfCounters.cpp
+ */
+
+#include <PerfCounters.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* event_names[PERF_NUM_EVENTS] = {
+  "cycles","instructions","cache_references","cache_misses","l1d_read_misses"
+};
+
+const char* perfEventName(int event){
+  return event_names[event];
+}
+
+#ifdef __linux__
+static int openEvent(int event){
+  struct perf_event_attr attr;
+  memset(&attr,0,sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  switch (event){
+  case PERF_CYCLES:           attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+  case PERF_INSTRUCTIONS:     attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+  case PERF_CACHE_REFERENCES: attr.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+  case PERF_CACHE_MISSES:     attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+  case PERF_L1D_READ_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16);
+    break;
+  }
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+}
+#endif
+
+PerfCounters::PerfCounters(){
+  for (int e=0;e<PERF_NUM_EVENTS;e++){
+#ifdef __linux__
+      fd[e] = openEvent(e);
+#else
+      fd[e] = -1;
+#endif
+      totals[e] = 0;
+  }
+}
+
+PerfCounters::~PerfCounters(){
+#ifdef __linux__
+  for (int e=0;e<PERF_NUM_EVENTS;e++){
+      if (fd[e]>=0)
+        close(fd[e]);
+  }
+#endif
+}
+
+bool PerfCounters::available() const {
+  for (int e=0;e<PERF_NUM_EVENTS;e++){
+      if (fd[e]>=0)
+        return true;
+  }
+  return false;
+}
+
+void PerfCounters::start(){
+#ifdef __linux__
+  for (int e=0;e<PERF_NUM_EVENTS;e++){
+      if (fd[e]<0)
+        continue;
+      ioctl(fd[e],PERF_EVENT_IOC_RESET,0);
+      ioctl(fd[e],PERF_EVENT_IOC_ENABLE,0);
+  }
+#endif
+}
+
+void PerfCounters::stop(){
+#ifdef __linux__
+  for (int e=0;e<PERF_NUM_EVENTS;e++){
+      if (fd[e]<0)
+        continue;
+      ioctl(fd[e],PERF_EVENT_IOC_DISABLE,0);
+      uint64_t n;
+      if (read(fd[e],&n,sizeof(n))==sizeof(n))
+        totals[e] += n;
+  }
+#endif
+}
+
+void PerfCounters::reset(){
+  memset(totals,0,sizeof(totals));
+}
+
+int64_t PerfCounters::total(int event) const {
+  return fd[event]>=0 ? totals[event] : -1;
+}
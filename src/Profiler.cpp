@@ -0,0 +1,238 @@
+/*
+ * Profiler.cpp
+ */
+
+#include <Profiler.h>
+#include <CpuFeatures.h>
+#include <atomic>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+using namespace std;
+
+static const char* stage_names[PROF_NUM_STAGES] = {
+  "frame","track","lk_forward","lk_backward","ncc","filter","bbpredict",
+  "detect","integral","blur","variance","ferns","nn","integration",
+  "learn","warps","negatives","train_ferns","train_nn"
+};
+
+static const char* counter_names[PROF_NUM_COUNTERS] = {
+  "windows","pass_variance","pass_ferns","pass_nn","nn_comparisons","tracked_points"
+};
+
+const char* profStageName(int stage){
+  return stage_names[stage];
+}
+
+const char* profCounterName(int counter){
+  return counter_names[counter];
+}
+
+//Small id per thread for the trace
+static int threadId(){
+  static atomic<int> next(0);
+  thread_local int id = next++;
+  return id;
+}
+
+void ProfHistogram::reset(){
+  memset(counts,0,sizeof(counts));
+  n = 0;
+  sum = 0;
+  maxv = 0;
+}
+
+//Bucket 0: below 1us, bucket b: up to 2^(b/4) us
+double ProfHistogram::bucketLimit(int b){
+  return pow(2.0,b/4.0)*0.001;
+}
+
+void ProfHistogram::add(double ms){
+  double us = ms*1000;
+  int b = us<1 ? 0 : (int)ceil(log2(us)*4);
+  if (b>=BUCKETS)
+    b = BUCKETS-1;
+  counts[b]++;
+  n++;
+  sum += ms;
+  if (ms>maxv)
+    maxv = ms;
+}
+
+double ProfHistogram::percentile(double p) const {
+  if (n==0)
+    return 0;
+  int rank = std::max(1,(int)ceil(p*n));
+  int seen = 0;
+  for (int b=0;b<BUCKETS;b++){
+      seen += counts[b];
+      if (seen>=rank)
+        return std::min(bucketLimit(b),maxv);
+  }
+  return maxv;
+}
+
+Profiler::Profiler(bool on)
+: enabled(on),tracing(false),trace_frames(0),events_next(0),marks_next(0),events_lock(new mutex){
+  reset();
+}
+
+void Profiler::reset(){
+  memset(start,0,sizeof(start));
+  memset(ran,0,sizeof(ran));
+  memset(&current,0,sizeof(current));
+  memset(&last,0,sizeof(last));
+  memset(totals,0,sizeof(totals));
+  for (int s=0;s<PROF_NUM_STAGES;s++)
+    histograms[s].reset();
+  num_frames = 0;
+  events.clear();
+  events_next = 0;
+  marks.clear();
+  marks_next = 0;
+  origin = now();
+}
+
+void Profiler::setTrace(bool on,int max_frames){
+  tracing = on;
+  trace_frames = max_frames;
+  vector<TraceEvent>().swap(events);
+  events_next = 0;
+  vector<TraceFrame>().swap(marks);
+  marks_next = 0;
+  if (on){
+      events.reserve((size_t)max_frames*PROF_NUM_STAGES);
+      marks.reserve(max_frames);
+  }
+}
+
+void Profiler::beginFrame(int frame){
+  if (!enabled)
+    return;
+  memset(&current,0,sizeof(current));
+  memset(ran,0,sizeof(ran));
+  current.frame = frame;
+  begin(PROF_FRAME);
+}
+
+void Profiler::endFrame(){
+  if (!enabled)
+    return;
+  end(PROF_FRAME);
+  for (int s=0;s<PROF_NUM_STAGES;s++){
+      if (ran[s])
+        histograms[s].add(current.ms[s]);
+  }
+  for (int c=0;c<PROF_NUM_COUNTERS;c++)
+    totals[c] += current.counters[c];
+  num_frames++;
+  last = current;
+  if (tracing && trace_frames>0){
+      TraceFrame m;
+      m.frame = current.frame;
+      m.end = now();
+      memcpy(m.counters,current.counters,sizeof(m.counters));
+      if (marks.size()<(size_t)trace_frames)
+        marks.push_back(m);
+      else
+        marks[marks_next] = m;
+      marks_next = (marks_next+1)%trace_frames;
+  }
+}
+
+void Profiler::record(int stage,int64_t t0,int64_t t1){
+  current.ms[stage] += (t1-t0)*1e-6;
+  ran[stage] = true;
+  if (!tracing || trace_frames<=0)
+    return;
+  TraceEvent e;
+  e.stage = stage;
+  e.tid = threadId();
+  e.frame = current.frame;
+  e.begin = t0;
+  e.end = t1;
+  lock_guard<mutex> lock(*events_lock);
+  size_t capacity = (size_t)trace_frames*PROF_NUM_STAGES;
+  if (events.size()<capacity)
+    events.push_back(e);
+  else
+    events[events_next] = e;
+  events_next = (events_next+1)%capacity;
+}
+
+void Profiler::writeJson(JsonWriter& json) const {
+  json.beginObject();
+  json.member("frames",num_frames);
+  json.member("isa",cpuIsaName(cpuIsa()));
+  json.key("stages_ms").beginObject();
+  for (int s=0;s<PROF_NUM_STAGES;s++){
+      const ProfHistogram& h = histograms[s];
+      json.key(stage_names[s]).beginObject();
+      json.member("count",h.count());
+      json.member("mean",h.mean());
+      json.member("p50",h.percentile(0.5));
+      json.member("p90",h.percentile(0.9));
+      json.member("p99",h.percentile(0.99));
+      json.member("max",h.max());
+      json.endObject();
+  }
+  json.endObject();
+  json.key("counters").beginObject();
+  for (int c=0;c<PROF_NUM_COUNTERS;c++){
+      json.key(counter_names[c]).beginObject();
+      json.member("total",(double)totals[c]);
+      json.member("per_frame",num_frames>0 ? (double)totals[c]/num_frames : 0.0);
+      json.endObject();
+  }
+  json.endObject();
+  json.endObject();
+}
+
+bool Profiler::writeTrace(const string& path) const {
+  FILE* file = fopen(path.c_str(),"w");
+  if (!file)
+    return false;
+  //Events of frames older than the oldest kept counter sample are dropped
+  int first_frame = 0;
+  if (!marks.empty())
+    first_frame = marks[marks.size()<(size_t)trace_frames ? 0 : marks_next].frame;
+  JsonWriter json(file);
+  json.beginObject();
+  json.member("displayTimeUnit","ms");
+  json.key("otherData").beginObject();
+  json.member("isa",cpuIsaName(cpuIsa()));
+  json.endObject();
+  json.key("traceEvents").beginArray();
+  for (size_t i=0;i<events.size();i++){
+      const TraceEvent& e = events[i];
+      if (e.frame<first_frame)
+        continue;
+      json.beginObject();
+      json.member("name",stage_names[e.stage]);
+      json.member("ph","X");
+      json.member("pid",1);
+      json.member("tid",(int)e.tid);
+      json.member("ts",(e.begin-origin)*1e-3);
+      json.member("dur",(e.end-e.begin)*1e-3);
+      json.key("args").beginObject();
+      json.member("frame",e.frame);
+      json.endObject();
+      json.endObject();
+  }
+  for (size_t i=0;i<marks.size();i++){
+      const TraceFrame& m = marks[i];
+      json.beginObject();
+      json.member("name","counters");
+      json.member("ph","C");
+      json.member("pid",1);
+      json.member("ts",(m.end-origin)*1e-3);
+      json.key("args").beginObject();
+      for (int c=0;c<PROF_NUM_COUNTERS;c++)
+        json.member(counter_names[c],(double)m.counters[c]);
+      json.endObject();
+      json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  return fclose(file)==0;
+}
@@ -0,0 +1,164 @@
+/*
+ * QuantizedNN.cpp
+ */
+
+#include <QuantizedNN.h>
+#include <CpuFeatures.h>
+#include <math.h>
+#include <string.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TLD_X86_KERNELS
+#include <immintrin.h>
+#endif
+using namespace cv;
+using namespace std;
+
+static int dotInt8Scalar(const int8_t* a,const int8_t* b,int n){
+  int sum = 0;
+  for (int i=0;i<n;i++)
+    sum += a[i]*b[i];
+  return sum;
+}
+
+#ifdef TLD_X86_KERNELS
+//Every variant is compiled for its own target and only called when the CPU
+//has it (CpuFeatures.h).
+//pmaddubsw would need one unsigned operand and saturates its int16 pair sums
+//at full int8 range, so the int8 values are widened to int16 and multiplied
+//with pmaddwd, which is exact.
+__attribute__((target("sse2")))
+static int hsum128(__m128i acc){
+  acc = _mm_add_epi32(acc,_mm_shuffle_epi32(acc,_MM_SHUFFLE(1,0,3,2)));
+  acc = _mm_add_epi32(acc,_mm_shuffle_epi32(acc,_MM_SHUFFLE(2,3,0,1)));
+  return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("sse2")))
+static int dotInt8SSE2(const int8_t* a,const int8_t* b,int n){
+  __m128i acc = _mm_setzero_si128();
+  for (int i=0;i<n;i+=16){
+      __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+      __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+      //Sign extension: the byte goes to the high half, arithmetic shift back
+      __m128i a0 = _mm_srai_epi16(_mm_unpacklo_epi8(va,va),8);
+      __m128i a1 = _mm_srai_epi16(_mm_unpackhi_epi8(va,va),8);
+      __m128i b0 = _mm_srai_epi16(_mm_unpacklo_epi8(vb,vb),8);
+      __m128i b1 = _mm_srai_epi16(_mm_unpackhi_epi8(vb,vb),8);
+      acc = _mm_add_epi32(acc,_mm_madd_epi16(a0,b0));
+      acc = _mm_add_epi32(acc,_mm_madd_epi16(a1,b1));
+  }
+  return hsum128(acc);
+}
+
+__attribute__((target("sse4.1")))
+static int dotInt8SSE41(const int8_t* a,const int8_t* b,int n){
+  __m128i acc = _mm_setzero_si128();
+  for (int i=0;i<n;i+=16){
+      __m128i va = _mm_loadu_si128((const __m128i*)(a+i));
+      __m128i vb = _mm_loadu_si128((const __m128i*)(b+i));
+      //pmovsxbw sign-extends in one instruction
+      __m128i a0 = _mm_cvtepi8_epi16(va);
+      __m128i a1 = _mm_cvtepi8_epi16(_mm_srli_si128(va,8));
+      __m128i b0 = _mm_cvtepi8_epi16(vb);
+      __m128i b1 = _mm_cvtepi8_epi16(_mm_srli_si128(vb,8));
+      acc = _mm_add_epi32(acc,_mm_madd_epi16(a0,b0));
+      acc = _mm_add_epi32(acc,_mm_madd_epi16(a1,b1));
+  }
+  return hsum128(acc);
+}
+
+__attribute__((target("avx2")))
+static int dotInt8AVX2(const int8_t* a,const int8_t* b,int n){
+  __m256i acc = _mm256_setzero_si256();
+  for (int i=0;i<n;i+=32){
+      __m256i a0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a+i)));
+      __m256i a1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(a+i+16)));
+      __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b+i)));
+      __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(b+i+16)));
+      acc = _mm256_add_epi32(acc,_mm256_madd_epi16(a0,b0));
+      acc = _mm256_add_epi32(acc,_mm256_madd_epi16(a1,b1));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc),_mm256_extracti128_si256(acc,1));
+  s = _mm_add_epi32(s,_mm_shuffle_epi32(s,_MM_SHUFFLE(1,0,3,2)));
+  s = _mm_add_epi32(s,_mm_shuffle_epi32(s,_MM_SHUFFLE(2,3,0,1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int dotInt8AVX512(const int8_t* a,const int8_t* b,int n){
+  //32 bytes widened to one register of 32 int16 per step
+  __m512i acc = _mm512_setzero_si512();
+  for (int i=0;i<n;i+=32){
+      __m512i va = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(a+i)));
+      __m512i vb = _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i*)(b+i)));
+      acc = _mm512_add_epi32(acc,_mm512_madd_epi16(va,vb));
+  }
+  return _mm512_reduce_add_epi32(acc);
+}
+#endif
+
+typedef int (*DotInt8)(const int8_t*,const int8_t*,int);
+
+#ifdef TLD_X86_KERNELS
+static const DotInt8 dot_kernels[ISA_NUM] = {dotInt8Scalar,dotInt8SSE2,dotInt8SSE41,dotInt8AVX2,dotInt8AVX512};
+#else
+static const DotInt8 dot_kernels[ISA_NUM] = {dotInt8Scalar,dotInt8Scalar,dotInt8Scalar,dotInt8Scalar,dotInt8Scalar};
+#endif
+
+int dotInt8(const int8_t* a,const int8_t* b,int n){
+  return dot_kernels[cpuIsa()](a,b,n);
+}
+
+int dotInt8(int isa,const int8_t* a,const int8_t* b,int n){
+  return dot_kernels[isa](a,b,n);
+}
+
+const char* dotInt8Kernel(){
+  return cpuIsaName(cpuIsa());
+}
+
+void QuantizedPatches::quantize(const Mat& patch,int stride,int8_t* out,float& scale,float& norm){
+  CV_Assert(patch.type()==CV_32F && (int)patch.total()<=stride);
+  Mat p = patch.isContinuous() ? patch : patch.clone();
+  const float* x = (const float*)p.data;
+  int n = p.total();
+  float maxv = 0;
+  for (int i=0;i<n;i++)
+    maxv = max(maxv,fabsf(x[i]));
+  float k = maxv>0 ? 127/maxv : 0;
+  int sq = 0;
+  for (int i=0;i<n;i++){
+      int q = cvRound(x[i]*k);
+      out[i] = (int8_t)q;
+      sq += q*q;
+  }
+  memset(out+n,0,stride-n);
+  scale = maxv/127;
+  norm = sqrtf((float)sq);
+}
+
+void QuantizedPatches::push_back(const Mat& patch){
+  if (empty())
+    stride = strideFor(patch.total());
+  float s, n;
+  data.resize(data.size()+stride);
+  quantize(patch,stride,&data[data.size()-stride],s,n);
+  scales.push_back(s);
+  norms.push_back(n);
+}
+
+void QuantizedPatches::assign(int _stride,const int8_t* patches,const float* _scales,const float* _norms,int n){
+  stride = _stride;
+  data.assign(patches,patches+(size_t)n*stride);
+  scales.assign(_scales,_scales+n);
+  norms.assign(_norms,_norms+n);
+}
+
+Mat QuantizedPatches::toFloat(int i,int side) const {
+  Mat p(side,side,CV_32F);
+  const int8_t* q = patch(i);
+  float* x = (float*)p.data;
+  for (int j=0;j<side*side;j++)
+    x[j] = q[j]*scales[i];
+  return p;
+}
@@ -0,0 +1,162 @@
+/*
+ * ResultSink.cpp
+ */
+
+#include <ResultSink.h>
+#include <string.h>
+using namespace std;
+
+BatchedResultSink::BatchedResultSink(FILE* file,int batch_size)
+: file(file),batch_size(batch_size>0 ? batch_size : 1),has_pending(false),stop(false),submitted(0),written(0){
+  batch.reserve(this->batch_size);
+  pending.reserve(this->batch_size);
+  if (file)
+    writer = thread(&BatchedResultSink::run,this);
+}
+
+BatchedResultSink::~BatchedResultSink(){
+  close();
+}
+
+void BatchedResultSink::close(){
+  if (!writer.joinable())
+    return;
+  submit(true);
+  {
+    lock_guard<mutex> lock(mtx);
+    stop = true;
+  }
+  cv_writer.notify_one();
+  writer.join();
+  fclose(file);
+  file = NULL;
+}
+
+void BatchedResultSink::write(const ResultRecord& r){
+  if (!file)
+    return;
+  batch.push_back(r);
+  if ((int)batch.size()>=batch_size)
+    submit(false);
+}
+
+void BatchedResultSink::flush(){
+  if (file)
+    submit(true);
+}
+
+void BatchedResultSink::submit(bool wait){
+  unique_lock<mutex> lock(mtx);
+  //Single buffer in flight: only waits if the writer is a whole batch behind
+  cv_done.wait(lock,[this]{return !has_pending;});
+  if (!batch.empty()){
+      pending.swap(batch);
+      has_pending = true;
+      submitted++;
+      cv_writer.notify_one();
+  }
+  if (wait)
+    cv_done.wait(lock,[this]{return written==submitted;});
+}
+
+void BatchedResultSink::run(){
+  vector<ResultRecord> work;
+  work.reserve(batch_size);
+  unique_lock<mutex> lock(mtx);
+  for (;;){
+      cv_writer.wait(lock,[this]{return has_pending || stop;});
+      if (!has_pending)
+        break;
+      work.swap(pending);
+      has_pending = false;
+      cv_done.notify_all();
+      lock.unlock();
+      writeBatch(file,work);
+      fflush(file);
+      work.clear();
+      lock.lock();
+      written++;
+      cv_done.notify_all();
+  }
+}
+
+CsvResultSink::CsvResultSink(const string& path,int batch_size)
+: BatchedResultSink(fopen(path.c_str(),"w"),batch_size){
+}
+
+CsvResultSink::~CsvResultSink(){
+  close();
+}
+
+void CsvResultSink::writeBatch(FILE* file,const vector<ResultRecord>& batch){
+  char line[128];
+  text.clear();
+  for (int i=0;i<batch.size();i++){
+      const ResultRecord& r = batch[i];
+      int n;
+      if (r.found)
+        n = snprintf(line,sizeof(line),"%d,%d,%d,%d,%f\n",r.x1,r.y1,r.x2,r.y2,r.conf);
+      else
+        n = snprintf(line,sizeof(line),"NaN,NaN,NaN,NaN,NaN\n");
+      text.insert(text.end(),line,line+n);
+  }
+  fwrite(&text[0],1,text.size(),file);
+}
+
+BinaryResultSink::BinaryResultSink(const string& path,int batch_size)
+: BatchedResultSink(fopen(path.c_str(),"wb"),batch_size){
+  if (!file)
+    return;
+  BinaryResultHeader header;
+  memcpy(header.magic,"TLDR",4);
+  header.version = BINARY_RESULT_VERSION;
+  header.record_size = sizeof(BinaryResultEntry);
+  fwrite(&header,sizeof(header),1,file);
+}
+
+BinaryResultSink::~BinaryResultSink(){
+  close();
+}
+
+void BinaryResultSink::writeBatch(FILE* file,const vector<ResultRecord>& batch){
+  entries.resize(batch.size());
+  for (int i=0;i<batch.size();i++){
+      const ResultRecord& r = batch[i];
+      BinaryResultEntry& e = entries[i];
+      e.frame = r.frame;
+      e.x1 = r.x1;
+      e.y1 = r.y1;
+      e.x2 = r.x2;
+      e.y2 = r.y2;
+      e.conf = r.conf;
+      e.found = r.found ? 1 : 0;
+  }
+  fwrite(&entries[0],sizeof(BinaryResultEntry),entries.size(),file);
+}
+
+bool BinaryResultSink::readFile(const string& path,vector<ResultRecord>& records){
+  FILE* f = fopen(path.c_str(),"rb");
+  if (!f)
+    return false;
+  BinaryResultHeader header;
+  if (fread(&header,sizeof(header),1,f)!=1 || memcmp(header.magic,"TLDR",4)!=0 ||
+      header.version!=BINARY_RESULT_VERSION || header.record_size!=sizeof(BinaryResultEntry)){
+      fclose(f);
+      return false;
+  }
+  records.clear();
+  BinaryResultEntry e;
+  while (fread(&e,sizeof(e),1,f)==1){
+      ResultRecord r;
+      r.frame = e.frame;
+      r.x1 = e.x1;
+      r.y1 = e.y1;
+      r.x2 = e.x2;
+      r.y2 = e.y2;
+      r.conf = e.conf;
+      r.found = e.found!=0;
+      records.push_back(r);
+  }
+  fclose(f);
+  return true;
+}
@@ -6,21 +6,42 @@
  */
 
 #include <TLD.h>
+#include <tld_log.h>
+#include <CpuFeatures.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <thread>
+#include <exception>
 using namespace cv;
 using namespace std;
 
+//Frames a degradation may shed work in a row before that work is measured again
+static const int BUDGET_PROBE = 30;
 
-TLD::TLD()
+TLD::TLD() : frame_budget_ms(0),parallel_detect(false),grid_shift(0),scale_step(0),num_scales(0),detect_tile(0),scale_gate(0),lk_motion(false),track_min_side(0),pyramid_detect(false),async_init(false),init_pending(false),init_done(false),
+  show_examples(false),checker(NULL)
 {
+  tracker.setProfiler(&prof);
+  //TLD_ISA applies to OpenCV's own SIMD paths too, before the first frame
+  cpuIsa();
 }
-TLD::TLD(const FileNode& file){
+TLD::TLD(const FileNode& file) : frame_budget_ms(0),parallel_detect(false),grid_shift(0),scale_step(0),num_scales(0),detect_tile(0),scale_gate(0),lk_motion(false),track_min_side(0),pyramid_detect(false),async_init(false),init_pending(false),init_done(false),
+  show_examples(false),checker(NULL){
+  tracker.setProfiler(&prof);
+  cpuIsa();
   read(file);
 }
 
+TLD::~TLD(){
+  waitInit();
+}
+
 void TLD::read(const FileNode& file){
   ///Bounding Box Parameters
   min_win = (int)file["min_win"];
+  grid_shift = (float)file["grid_shift"];
+  scale_step = (float)file["scale_step"];
+  num_scales = (int)file["num_scales"];
   ///Genarator Parameters
   //initial parameters for positive examples
   patch_size = (int)file["patch_size"];
@@ -40,14 +61,42 @@ void TLD::read(const FileNode& file){
   //parameters for negative examples
   bad_overlap = (float)file["overlap"];
   bad_patches = (int)file["num_patches"];
+  frame_budget_ms = (float)file["frame_budget_ms"];
+  parallel_detect = (int)file["parallel_detect"]!=0;
+  detect_tile = (int)file["detect_tile"];
+  scale_gate = (int)file["scale_gate"];
+  lk_motion = (int)file["lk_motion"]!=0;
+  track_min_side = (int)file["track_min_side"];
+  pyramid_detect = (int)file["pyramid_detect"]!=0;
+  async_init = (int)file["async_init"]!=0;
   classifier.read(file);
+  clusterer.read(file);
+}
+
+void TLD::setReferencePaths(){
+  //lk_motion and track_min_side change the tracked points like scale_gate and
+  //pyramid_detect change the detections, both sessions keep them
+  parallel_detect = false;
+  detect_tile = 0;
+  async_init = false;
+  classifier.setQuantized(false);
 }
 
-void TLD::init(const Mat& frame1,const Rect& box,FILE* bb_file){
-  //bb_file = fopen("bounding_boxes.txt","w");
+void TLD::setup(const Mat& frame1,const Rect& box){
   //Get Bounding Boxes
     buildGrid(frame1,box);
-    printf("Created %d bounding boxes\n",(int)grid.size());
+    TLD_INFO("Created %d bounding boxes",(int)grid.size());
+  //Scales at least twice the object's are coded on the level where they are
+  //closest to its size (at most 16x smaller)
+  scale_levels.assign(grid.numScales(),0);
+  int base = grid.numScales()>0 ? grid.scale(max(0,grid.nearestScale(box.size()))).size.area() : 0;
+  for (int s=0;pyramid_detect && s<grid.numScales();s++){
+      Size size = grid.scale(s).size;
+      int l = 0;
+      while (l<4 && (size.width>>(l+1))*(size.height>>(l+1))>=base)
+        l++;
+      scale_levels[s] = l;
+  }
   ///Preparation
   //allocation
   iisum.create(frame1.rows+1,frame1.cols+1,CV_32F);
@@ -55,62 +104,122 @@ void TLD::init(const Mat& frame1,const Rect& box,FILE* bb_file){
   dconf.reserve(100);
   dbb.reserve(100);
   bbox_step =7;
-  //tmp.conf.reserve(grid.size());
-  tmp.conf = vector<float>(grid.size());
-  tmp.patt = vector<vector<int> >(grid.size(),vector<int>(10,0));
-  //tmp.patt.reserve(grid.size());
-  dt.bb.reserve(grid.size());
-  good_boxes.reserve(grid.size());
-  bad_boxes.reserve(grid.size());
+  //fern results are only kept for windows passing the variance filter
+  tmp.var_pass.clear();
+  tmp.conf.clear();
+  tmp.patt.clear();
+  dt.bb.reserve(100);
   pEx.create(patch_size,patch_size,CV_64F);
+  tracked=false;
+  detected=false;
+  degraded=0;
+  detect_ms=0;
+  gated_ms=0;
+  learn_ms=0;
+  detect_shed=0;
+  learn_shed=0;
   //Init Generator
   generator = PatchGenerator (0,0,noise_init,true,1-scale_init,1+scale_init,-angle_init*CV_PI/180,angle_init*CV_PI/180,-angle_init*CV_PI/180,angle_init*CV_PI/180);
+}
+
+void TLD::init(const Mat& frame1,const Rect& box,TLDResult& result){
+  waitInit();
+  setup(frame1,box);
   getOverlappingBoxes(box,num_closest_init);
-  printf("Found %d good boxes, %d bad boxes\n",(int)good_boxes.size(),(int)bad_boxes.size());
-  printf("Best Box: %d %d %d %d\n",best_box.x,best_box.y,best_box.width,best_box.height);
-  printf("Bounding box hull: %d %d %d %d\n",bbhull.x,bbhull.y,bbhull.width,bbhull.height);
+  TLD_INFO("Found %d good boxes",(int)good_boxes.size());
+  TLD_INFO("Best Box: %d %d %d %d",best_box.x,best_box.y,best_box.width,best_box.height);
+  TLD_INFO("Bounding box hull: %d %d %d %d",bbhull.x,bbhull.y,bbhull.width,bbhull.height);
   //Correct Bounding Box
   lastbox=best_box;
   lastconf=1;
   lastvalid=true;
+  lastboxfound=true;
+  motion.reset();
+  motion.observe(lastbox);
+  frame_idx=0;
   //Print
-  fprintf(bb_file,"%d,%d,%d,%d,%f\n",lastbox.x,lastbox.y,lastbox.br().x,lastbox.br().y,lastconf);
+  getResult(result);
   //Prepare Classifier
-  classifier.prepare(scales);
-  ///Generate Data
-  // Generate positive data
-  generatePositiveData(frame1,num_warps_init);
+  classifier.prepare(grid.scaleSizes());
+  classifier.setLevels(scale_levels);
+  //Training draws from its own random numbers, seeded from this thread's
+  //(which move past the seed, so later warps differ). The model is the same
+  //with and without async_init.
+  RNG& rng = theRNG();
+  uint64 seed = (unsigned)rng;
+  seed = seed<<32 | (unsigned)rng;
+  if (async_init){
+      //The job keeps its own copy of the frame
+      Mat frame = frame1.clone();
+      init_pending = true;
+      init_done = false;
+      trainer.run([this,frame,box,seed](){
+        theRNG() = RNG(seed);
+        trainDetector(frame,box);
+        init_done = true;
+      });
+      result.degraded = TLD_INIT_PENDING;
+  }
+  else {
+      RNG caller = rng;
+      rng = RNG(seed);
+      trainDetector(frame1,box);
+      rng = caller;
+  }
+}
+
+void TLD::waitInit(){
+  if (!init_pending)
+    return;
+  trainer.wait();
+  init_pending = false;
+}
+
+//Joins a thread when leaving the scope, also on an exception
+struct ThreadJoiner{
+  explicit ThreadJoiner(thread& t):t(t){}
+  ~ThreadJoiner(){ t.join(); }
+  thread& t;
+};
+
+void TLD::trainDetector(const Mat& frame1,const Rect& box){
   // Set variance threshold
   Scalar stdev, mean;
   meanStdDev(frame1(best_box),mean,stdev);
   integral(frame1,iisum,iisqsum);
   var = pow(stdev.val[0],2)*0.5; //getVar(best_box,iisum,iisqsum);
-  cout << "variance: " << var << endl;
+  TLD_INFO("variance: %g",var);
   //check variance
-  double vr =  getVar(best_box,iisum,iisqsum)*0.5;
-  cout << "check variance: " << vr << endl;
-  // Generate negative data
-  generateNegativeData(frame1);
-  //Split Negative Ferns into Training and Testing sets (they are already shuffled)
-  int half = (int)nX.size()*0.5f;
-  nXT.assign(nX.begin()+half,nX.end());
-  nX.resize(half);
+  TLD_DEBUG("check variance: %g",getVar(best_box,iisum,iisqsum)*0.5);
+  ///Generate Data
+  //Negative data on a second thread while the positive warps are generated
+  //(only the negatives draw from rand(), the positives from theRNG())
+  exception_ptr negatives_error;
+  thread negatives([&](){
+    try{
+        grid.farFrom(box,bad_overlap,bad_boxes);
+        TLD_INFO("Found %d bad boxes",(int)bad_boxes.size());
+        generateNegativeData(frame1);
+    }
+    catch(...){
+        negatives_error = current_exception();
+    }
+  });
+  {
+    ThreadJoiner join(negatives);
+    generatePositiveData(frame1,num_warps_init);
+  }
+  if (negatives_error)
+    rethrow_exception(negatives_error);
+  //Negative Ferns are already split into Training and Testing sets
   ///Split Negative NN Examples into Training and Testing sets
-  half = (int)nEx.size()*0.5f;
+  int half = (int)nEx.size()*0.5f;
   nExT.assign(nEx.begin()+half,nEx.end());
   nEx.resize(half);
   //Merge Negative Data with Positive Data and shuffle it
-  vector<pair<vector<int>,int> > ferns_data(nX.size()+pX.size());
-  vector<int> idx = index_shuffle(0,ferns_data.size());
-  int a=0;
-  for (int i=0;i<pX.size();i++){
-      ferns_data[idx[a]] = pX[i];
-      a++;
-  }
-  for (int i=0;i<nX.size();i++){
-      ferns_data[idx[a]] = nX[i];
-      a++;
-  }
+  FernTrainingSet ferns_data = pX;
+  ferns_data.append(nX);
+  ferns_data.shuffle();
   //Data already have been shuffled, just putting it in the same vector
   vector<cv::Mat> nn_data(nEx.size()+1);
   nn_data[0] = pEx;
@@ -124,6 +233,98 @@ void TLD::init(const Mat& frame1,const Rect& box,FILE* bb_file){
   classifier.evaluateTh(nXT,nExT);
 }
 
+bool TLD::saveModel(const string& path){
+  waitInit();
+  ModelWriter writer;
+  if (!writer.open(path)){
+      TLD_ERROR("Could not write model %s",path.c_str());
+      return false;
+  }
+  ModelHeader header;
+  initModelHeader(header);
+  header.frame_width = iisum.cols-1;
+  header.frame_height = iisum.rows-1;
+  header.box_width = grid.box().width;
+  header.box_height = grid.box().height;
+  header.min_win = min_win;
+  header.num_scales = grid.numScales();
+  vector<int> sizes;
+  for (int s=0;s<grid.numScales();s++){
+      sizes.push_back(grid.scale(s).size.width);
+      sizes.push_back(grid.scale(s).size.height);
+  }
+  header.scales = writer.append(&sizes[0],sizes.size()*sizeof(int));
+  header.lastbox[0] = lastbox.x;
+  header.lastbox[1] = lastbox.y;
+  header.lastbox[2] = lastbox.width;
+  header.lastbox[3] = lastbox.height;
+  header.lastconf = lastconf;
+  header.lastvalid = lastvalid;
+  header.var = var;
+  header.patch_size = patch_size;
+  Mat pattern = pEx.isContinuous() ? pEx : pEx.clone();
+  header.pattern = writer.append(pattern.data,patch_size*patch_size*sizeof(float));
+  classifier.saveState(header,writer);
+  if (!writer.finish(header)){
+      TLD_ERROR("Could not write model %s",path.c_str());
+      return false;
+  }
+  TLD_INFO("Model saved to %s",path.c_str());
+  return true;
+}
+
+bool TLD::loadModel(const string& path,const Mat& frame1,const Rect& box,TLDResult& result){
+  waitInit();
+  shared_ptr<MappedFile> file(new MappedFile);
+  const ModelHeader* header;
+  if (!file->open(path) || !checkModelHeader(*file,header)){
+      TLD_ERROR("%s is not a TLD model",path.c_str());
+      return false;
+  }
+  if (header->frame_width!=frame1.cols || header->frame_height!=frame1.rows || header->patch_size!=patch_size){
+      TLD_ERROR("Model %s was trained on %dx%d frames with %dx%d patches",path.c_str(),
+          header->frame_width,header->frame_height,header->patch_size,header->patch_size);
+      return false;
+  }
+  //Rebuild the grid from the trained object size, at the new position if given
+  Rect target = box;
+  if (box.area()==0)
+    target = Rect(header->lastbox[0],header->lastbox[1],header->lastbox[2],header->lastbox[3]);
+  min_win = header->min_win;
+  setup(frame1,Rect(target.x,target.y,header->box_width,header->box_height));
+  int num_scales = grid.numScales();
+  bool same_scales = file->contains(header->scales,num_scales*2*sizeof(int)) && header->num_scales==num_scales;
+  const int* sizes = (const int*)file->section(header->scales);
+  for (int s=0;same_scales && s<num_scales;s++)
+    same_scales = sizes[2*s]==grid.scale(s).size.width && sizes[2*s+1]==grid.scale(s).size.height;
+  if (!same_scales || !file->contains(header->pattern,patch_size*patch_size*sizeof(float)) ||
+      !classifier.loadState(*header,file)){
+      TLD_ERROR("Model %s is corrupted",path.c_str());
+      return false;
+  }
+  classifier.setLevels(scale_levels);
+  Mat(patch_size,patch_size,CV_32F,(void*)file->section(header->pattern)).copyTo(pEx);
+  var = header->var;
+  if (box.area()>0){
+      getOverlappingBoxes(box,num_closest_init);
+      lastbox=best_box;
+      lastconf=1;
+      lastvalid=true;
+  }
+  else{
+      lastbox=BoundingBox(target);
+      lastconf=header->lastconf;
+      lastvalid=header->lastvalid!=0;
+  }
+  lastboxfound=true;
+  motion.reset();
+  motion.observe(lastbox);
+  frame_idx=0;
+  getResult(result);
+  TLD_INFO("Model loaded from %s: %d positive %d negative NN examples",path.c_str(),header->num_pex,header->num_nex);
+  return true;
+}
+
 /* Generate Positive data
  * Inputs:
  * - good_boxes (bbP)
@@ -145,22 +346,21 @@ void TLD::generatePositiveData(const Mat& frame, int num_warps){
   RNG& rng = theRNG();
   Point2f pt(bbhull.x+(bbhull.width-1)*0.5f,bbhull.y+(bbhull.height-1)*0.5f);
   vector<int> fern(classifier.getNumStructs());
-  pX.clear();
-  Mat patch;
-  if (pX.capacity()<num_warps*good_boxes.size())
-    pX.reserve(num_warps*good_boxes.size());
-  int idx;
+  pX.reset(classifier.getNumStructs());
+  BoundingBox box;
+  DetPyramid pyr;
   for (int i=0;i<num_warps;i++){
-     if (i>0)
-       generator(frame,pt,warped,bbhull.size(),rng);
-       for (int b=0;b<good_boxes.size();b++){
-         idx=good_boxes[b];
-		 patch = img(grid[idx]);
-         classifier.getFeatures(patch,grid[idx].sidx,fern);
-         pX.push_back(make_pair(fern,1));
+     if (i>0){
+         generator(frame,pt,warped,bbhull.size(),rng);
+     }
+     buildPyramid(img,bbhull,pyr);
+     for (int b=0;b<good_boxes.size();b++){
+         box = grid.window(good_boxes[b]);
+         windowFeatures(pyr,box,fern);
+         pX.add(fern,1);
      }
   }
-  printf("Positive examples generated: ferns:%d NN:1\n",(int)pX.size());
+  TLD_DEBUG("Positive examples generated: ferns:%d NN:1",pX.size());
 }
 
 void TLD::getPattern(const Mat& img, Mat& pattern,Scalar& mean,Scalar& stdev){
@@ -177,37 +377,43 @@ void TLD::generateNegativeData(const Mat& frame){
  * - bad_boxes (Boxes far from the bounding box)
  * - variance (pEx variance)
  * Outputs
- * - Negative fern features (nX)
+ * - Negative fern features, half for training (nX) and half for testing (nXT)
  * - Negative NN examples (nEx)
  */
   random_shuffle(bad_boxes.begin(),bad_boxes.end());//Random shuffle bad_boxes indexes
-  int idx;
+  BoundingBox box;
   //Get Fern Features of the boxes with big variance (calculated using integral images)
   int a=0;
   //int num = std::min((int)bad_boxes.size(),(int)bad_patches*100); //limits the size of bad_boxes to try
-  printf("negative data generation started.\n");
-  vector<int> fern(classifier.getNumStructs());
-  nX.reserve(bad_boxes.size());
+  TLD_DEBUG("negative data generation started.");
+  int numtrees = classifier.getNumStructs();
+  vector<int> fern(numtrees);
+  vector<int> codes;
+  codes.reserve(bad_boxes.size()*numtrees);
   Mat patch;
+  DetPyramid pyr;
+  buildPyramid(frame,Rect(0,0,frame.cols,frame.rows),pyr);
   for (int j=0;j<bad_boxes.size();j++){
-      idx = bad_boxes[j];
-          if (getVar(grid[idx],iisum,iisqsum)<var*0.5f)
+      box = grid.window(bad_boxes[j]);
+          if (getVar(box,iisum,iisqsum)<var*0.5f)
             continue;
-      patch =  frame(grid[idx]);
-	  classifier.getFeatures(patch,grid[idx].sidx,fern);
-      nX.push_back(make_pair(fern,0));
+      windowFeatures(pyr,box,fern);
+      codes.insert(codes.end(),fern.begin(),fern.end());
       a++;
   }
-  printf("Negative examples generated: ferns: %d ",a);
+  //Split into Training and Testing sets (they are already shuffled)
+  nX.reset(numtrees);
+  nXT.reset(numtrees);
+  for (int i=0;i<a;i++)
+    (i<a/2 ? nX : nXT).add(&codes[i*numtrees],0);
   //random_shuffle(bad_boxes.begin(),bad_boxes.begin()+bad_patches);//Randomly selects 'bad_patches' and get the patterns for NN;
   Scalar dum1, dum2;
   nEx=vector<Mat>(bad_patches);
   for (int i=0;i<bad_patches;i++){
-      idx=bad_boxes[i];
-	  patch = frame(grid[idx]);
+	  patch = frame(grid.window(bad_boxes[i]));
       getPattern(patch,nEx[i],dum1,dum2);
   }
-  printf("NN: %d\n",(int)nEx.size());
+  TLD_INFO("Negative examples generated: ferns: %d NN: %d",a,(int)nEx.size());
 }
 
 double TLD::getVar(const BoundingBox& box,const Mat& sum,const Mat& sqsum){
@@ -224,29 +430,66 @@ double TLD::getVar(const BoundingBox& box,const Mat& sum,const Mat& sqsum){
   return sqmean-mean*mean;
 }
 
-void TLD::processFrame(const cv::Mat& img1,const cv::Mat& img2,vector<Point2f>& points1,vector<Point2f>& points2,BoundingBox& bbnext,bool& lastboxfound, bool tl, FILE* bb_file){
+void TLD::processFrame(const cv::Mat& img1,const cv::Mat& img2,TLDResult& result,bool tl){
   vector<BoundingBox> cbb;
   vector<float> cconf;
   int confident_detections=0;
   int didx; //detection index
-  ///Track
-  if(lastboxfound && tl){
-      track(img1,img2,points1,points2);
+  BoundingBox bbnext=lastbox;
+  double ms = 1000/getTickFrequency();
+  int64 t0 = getTickCount();
+  int64 deadline = frame_budget_ms>0 ? t0+(int64)(frame_budget_ms*getTickFrequency()/1000) : 0;
+  int64_t nn_comparisons = classifier.nn_comparisons;
+  degraded = 0;
+  prof.beginFrame(frame_idx+1);
+  result.points1.clear();
+  result.points2.clear();
+  ///Track and detect, on two threads with parallel_detect
+  if (init_pending && init_done)
+    waitInit();
+  if (init_pending)
+    degraded |= TLD_INIT_PENDING;
+  bool tracking = lastboxfound && tl;
+  bool parallel = parallel_detect && tracking && !init_pending;
+  Rect roi;
+  Range scales;
+  int64 t1, t2, td;
+  if (parallel){
+      //The tracked box is not known yet, detection plans around the last one
+      planDetection(lastbox,true,t0,deadline,tl,img2.size(),roi,scales);
+      detector.run([&](){
+        td = getTickCount();
+        runDetection(img2,roi,deadline,scales);
+        t2 = getTickCount();
+      });
+  }
+  prof.begin(PROF_TRACK);
+  if(tracking){
+      track(img1,img2,result.points1,result.points2);
   }
   else{
       tracked = false;
   }
-  ///Detect
-  detect(img2);
+  prof.end(PROF_TRACK);
+  t1 = getTickCount();
+  if (parallel)
+    detector.wait();
+  else {
+      planDetection(tbb,tracked,t1,deadline,tl,img2.size(),roi,scales);
+      td = t1;
+      runDetection(img2,roi,deadline,scales);
+      t2 = getTickCount();
+  }
   ///Integration
+  prof.begin(PROF_INTEGRATION);
   if (tracked){
       bbnext=tbb;
       lastconf=tconf;
       lastvalid=tvalid;
-      printf("Tracked\n");
+      TLD_DEBUG("Tracked");
       if(detected){                                               //   if Detected
           clusterConf(dbb,dconf,cbb,cconf);                       //   cluster detections
-          printf("Found %d clusters\n",(int)cbb.size());
+          TLD_DEBUG("Found %d clusters",(int)cbb.size());
           for (int i=0;i<cbb.size();i++){
               if (bbOverlap(tbb,cbb[i])<0.5 && cconf[i]>tconf){  //  Get index of a clusters that is far from tracker and are more confident than the tracker
                   confident_detections++;
@@ -254,13 +497,14 @@ void TLD::processFrame(const cv::Mat& img1,const cv::Mat& img2,vector<Point2f>&
               }
           }
           if (confident_detections==1){                                //if there is ONE such a cluster, re-initialize the tracker
-              printf("Found a better match..reinitializing tracking\n");
+              TLD_DEBUG("Found a better match..reinitializing tracking");
               bbnext=cbb[didx];
               lastconf=cconf[didx];
               lastvalid=false;
+              motion.reset();
           }
           else {
-              printf("%d confident cluster was found\n",confident_detections);
+              TLD_DEBUG("%d confident cluster was found",confident_detections);
               int cx=0,cy=0,cw=0,ch=0;
               int close_detections=0;
               for (int i=0;i<dbb.size();i++){
@@ -270,7 +514,7 @@ void TLD::processFrame(const cv::Mat& img1,const cv::Mat& img2,vector<Point2f>&
                       cw += dbb[i].width;
                       ch += dbb[i].height;
                       close_detections++;
-                      printf("weighted detection: %d %d %d %d\n",dbb[i].x,dbb[i].y,dbb[i].width,dbb[i].height);
+                      TLD_DEBUG("weighted detection: %d %d %d %d",dbb[i].x,dbb[i].y,dbb[i].width,dbb[i].height);
                   }
               }
               if (close_detections>0){
@@ -278,42 +522,76 @@ void TLD::processFrame(const cv::Mat& img1,const cv::Mat& img2,vector<Point2f>&
                   bbnext.y = cvRound((float)(10*tbb.y+cy)/(float)(10+close_detections));
                   bbnext.width = cvRound((float)(10*tbb.width+cw)/(float)(10+close_detections));
                   bbnext.height =  cvRound((float)(10*tbb.height+ch)/(float)(10+close_detections));
-                  printf("Tracker bb: %d %d %d %d\n",tbb.x,tbb.y,tbb.width,tbb.height);
-                  printf("Average bb: %d %d %d %d\n",bbnext.x,bbnext.y,bbnext.width,bbnext.height);
-                  printf("Weighting %d close detection(s) with tracker..\n",close_detections);
+                  TLD_DEBUG("Tracker bb: %d %d %d %d",tbb.x,tbb.y,tbb.width,tbb.height);
+                  TLD_DEBUG("Average bb: %d %d %d %d",bbnext.x,bbnext.y,bbnext.width,bbnext.height);
+                  TLD_DEBUG("Weighting %d close detection(s) with tracker..",close_detections);
               }
               else{
-                printf("%d close detections were found\n",close_detections);
+                TLD_DEBUG("%d close detections were found",close_detections);
 
               }
           }
       }
   }
   else{                                       //   If NOT tracking
-      printf("Not tracking..\n");
+      TLD_DEBUG("Not tracking..");
       lastboxfound = false;
       lastvalid = false;
+      motion.reset();
       if(detected){                           //  and detector is defined
           clusterConf(dbb,dconf,cbb,cconf);   //  cluster detections
-          printf("Found %d clusters\n",(int)cbb.size());
+          TLD_DEBUG("Found %d clusters",(int)cbb.size());
           if (cconf.size()==1){
               bbnext=cbb[0];
               lastconf=cconf[0];
-              printf("Confident detection..reinitializing tracker\n");
+              TLD_DEBUG("Confident detection..reinitializing tracker");
               lastboxfound = true;
           }
       }
   }
   lastbox=bbnext;
   if (lastboxfound)
-    fprintf(bb_file,"%d,%d,%d,%d,%f\n",lastbox.x,lastbox.y,lastbox.br().x,lastbox.br().y,lastconf);
-  else
-    fprintf(bb_file,"NaN,NaN,NaN,NaN,NaN\n");
-  if (lastvalid && tl)
-    learn(img2);
+    motion.observe(lastbox);
+  frame_idx++;
+  getResult(result);
+  prof.end(PROF_INTEGRATION);
+  int64 t3 = getTickCount();
+  if (lastvalid && tl && deadline && t3+learn_ms/ms>deadline && learn_shed<BUDGET_PROBE)
+    degraded |= TLD_DEFER_LEARNING;
+  if (lastvalid && tl && !(degraded & TLD_INIT_PENDING)){
+      if (degraded & TLD_DEFER_LEARNING)
+        learn_shed++;
+      else {
+          ProfScope scope(prof,PROF_LEARN);
+          learn(img2);
+          double t = (getTickCount()-t3)*ms;
+          learn_ms = learn_ms>0 ? 0.9*learn_ms+0.1*t : t;
+          learn_shed = 0;
+      }
+  }
+  result.degraded = degraded;
+  prof.count(PROF_NN_COMPARISONS,classifier.nn_comparisons-nn_comparisons);
+  prof.endFrame();
+  int64 t4 = getTickCount();
+  result.timings.track = (t1-t0)*ms;
+  result.timings.detect = (t2-td)*ms;
+  result.timings.learn = (t4-t3)*ms;
+  result.timings.total = (t4-t0)*ms;
 }
 
 
+void TLD::getResult(TLDResult& result){
+  result.frame = frame_idx;
+  result.found = lastboxfound;
+  result.valid = lastvalid;
+  result.tracked = tracked;
+  result.detected = detected;
+  result.box = lastbox;
+  result.conf = lastconf;
+  result.timings.track = result.timings.detect = result.timings.learn = result.timings.total = 0;
+  result.degraded = 0;
+}
+
 void TLD::track(const Mat& img1, const Mat& img2,vector<Point2f>& points1,vector<Point2f>& points2){
   /*Inputs:
    * -current frame(img2), last frame(img1), last Bbox(bbox_f[0]).
@@ -323,21 +601,66 @@ void TLD::track(const Mat& img1, const Mat& img2,vector<Point2f>& points1,vector
   //Generate points
   bbPoints(points1,lastbox);
   if (points1.size()<1){
-      printf("BB= %d %d %d %d, Points not generated\n",lastbox.x,lastbox.y,lastbox.width,lastbox.height);
+      TLD_DEBUG("BB= %d %d %d %d, Points not generated",lastbox.x,lastbox.y,lastbox.width,lastbox.height);
       tvalid=false;
       tracked=false;
       return;
   }
-  vector<Point2f> points = points1;
+  //Large boxes are tracked on a crop of the frames at a coarser level, f
+  //pixels of the frame per pixel of the level
+  int level = trackingLevel(lastbox);
+  Mat small1 = img1, small2 = img2;
+  Point2f offset(0,0);
+  if (level>0 && !trackingFrames(img1,img2,lastbox,level,small1,small2,offset))
+    level = 0;
+  float f = 1<<level;
+  vector<Point2f> points(points1.size());
+  for (size_t i=0;i<points1.size();i++)
+    points[i] = (points1[i]-offset)*(1/f);
+  vector<Point2f> start = points, seed;
+  float residual = 0;
   //Frame-to-frame tracking with forward-backward error cheking
-  tracked = tracker.trackf2f(img1,img2,points,points2);
+  if (lk_motion && motion.ready()){
+      //From the predicted positions, cold from points1 if that fails
+      motion.predict(lastbox,points1,seed);
+      for (size_t i=0;i<seed.size();i++)
+        seed[i] = (seed[i]-offset)*(1/f);
+      residual = motion.uncertainty()/f;
+      points2 = seed;
+      tracked = tracker.trackf2f(small1,small2,points,points2,residual);
+      if (!tracked){
+          points = start;
+          tracked = tracker.trackf2f(small1,small2,points,points2);
+      }
+  }
+  else
+    tracked = tracker.trackf2f(small1,small2,points,points2);
+  float fb = tracker.getFB()*f;
+  if (level>0){
+      //Back to frame coordinates
+      for (size_t i=0;i<points.size();i++)
+        points[i] = points[i]*f+offset;
+      for (size_t i=0;i<points2.size();i++)
+        points2[i] = points2[i]*f+offset;
+  }
+  if (checker)
+    checker->checkTrack(*this,small1,small2,f,offset,start,seed,residual,points,points2,tracked);
   if (tracked){
+      prof.count(PROF_TRACKED_POINTS,points.size());
       //Bounding box prediction
+      prof.begin(PROF_BBPREDICT);
       bbPredict(points,points2,lastbox,tbb);
-      if (tracker.getFB()>10 || tbb.x>img2.cols ||  tbb.y>img2.rows || tbb.br().x < 1 || tbb.br().y <1){
+      prof.end(PROF_BBPREDICT);
+      if (fb>10 || tbb.x>img2.cols ||  tbb.y>img2.rows || tbb.br().x < 1 || tbb.br().y <1){
           tvalid =false; //too unstable prediction or bounding box out of image
           tracked = false;
-          printf("Too unstable predictions FB error=%f\n",tracker.getFB());
+          TLD_DEBUG("Too unstable predictions FB error=%f",fb);
+          return;
+      }
+      //The classifier is still being trained, the box is taken as tracked
+      if (init_pending){
+          tconf = lastconf;
+          tvalid = lastvalid;
           return;
       }
       //Estimate Confidence and Validity
@@ -358,8 +681,37 @@ void TLD::track(const Mat& img1, const Mat& img2,vector<Point2f>& points1,vector
       }
   }
   else
-    printf("No points tracked\n");
+    TLD_DEBUG("No points tracked");
+
+}
 
+int TLD::trackingLevel(const BoundingBox& box) const {
+  int level = 0;
+  if (track_min_side>0){
+      int side = min(box.width,box.height);
+      while ((side>>(level+1))>=track_min_side && level<4)
+        level++;
+  }
+  return level;
+}
+
+bool TLD::trackingFrames(const Mat& img1,const Mat& img2,const BoundingBox& box,int level,
+    Mat& small1,Mat& small2,Point2f& offset){
+  //One box of margin on each side, the motion a frame can bring at that size
+  Rect area = Rect(box.x-box.width,box.y-box.height,3*box.width,3*box.height) & Rect(0,0,img1.cols,img1.rows);
+  if (area.area()==0)
+    return false;
+  offset = Point2f(area.x,area.y);
+  small1 = img1(area);
+  small2 = img2(area);
+  for (int l=0;l<level;l++){
+      Mat down1, down2;
+      pyrDown(small1,down1);
+      pyrDown(small2,down2);
+      small1 = down1;
+      small2 = down2;
+  }
+  return true;
 }
 
 void TLD::bbPoints(vector<cv::Point2f>& points,const BoundingBox& bb){
@@ -380,7 +732,7 @@ void TLD::bbPredict(const vector<cv::Point2f>& points1,const vector<cv::Point2f>
   int npoints = (int)points1.size();
   vector<float> xoff(npoints);
   vector<float> yoff(npoints);
-  printf("tracked points : %d\n",npoints);
+  TLD_DEBUG("tracked points : %d",npoints);
   for (int i=0;i<npoints;i++){
       xoff[i]=points2[i].x-points1[i].x;
       yoff[i]=points2[i].y-points1[i].y;
@@ -403,99 +755,384 @@ void TLD::bbPredict(const vector<cv::Point2f>& points1,const vector<cv::Point2f>
   }
   float s1 = 0.5*(s-1)*bb1.width;
   float s2 = 0.5*(s-1)*bb1.height;
-  printf("s= %f s1= %f s2= %f \n",s,s1,s2);
+  TLD_DEBUG("s= %f s1= %f s2= %f",s,s1,s2);
   bb2.x = round( bb1.x + dx -s1);
   bb2.y = round( bb1.y + dy -s2);
   bb2.width = round(bb1.width*s);
   bb2.height = round(bb1.height*s);
-  printf("predicted bb: %d %d %d %d\n",bb2.x,bb2.y,bb2.br().x,bb2.br().y);
+  TLD_DEBUG("predicted bb: %d %d %d %d",bb2.x,bb2.y,bb2.br().x,bb2.br().y);
+}
+
+//Scales [s0,s1) of a detect() scale range (empty: all)
+static void scaleRange(const Range& scales,int n,int& s0,int& s1){
+  s0 = scales.empty() ? 0 : max(0,scales.start);
+  s1 = scales.empty() ? n : min(n,scales.end);
+}
+
+void TLD::planDetection(const BoundingBox& around,bool have_box,int64 now,int64 deadline,bool tl,const Size& frame,
+    Rect& roi,Range& scales){
+  roi = Rect();
+  scales = Range();
+  //The object's size changes slowly while it is tracked, once lost every scale is searched
+  if (scale_gate>0 && have_box){
+      int s = grid.nearestScale(around.size());
+      if (s>=0)
+        scales = Range(max(0,s-scale_gate),min(grid.numScales(),s+scale_gate+1));
+  }
+  if (!deadline)
+    return;
+  double ms = 1000/getTickFrequency();
+  //Shed work in order: learning, detection outside the tracker neighbourhood, detection
+  double left = (deadline-now)*ms;
+  //The estimates only follow what is run, every BUDGET_PROBE frames the shed
+  //work runs once anyway so that they recover from a slow frame
+  double cost = !scales.empty() && gated_ms>0 ? gated_ms : detect_ms;
+  if (left < cost+(tl ? learn_ms : 0) && learn_shed<BUDGET_PROBE)
+    degraded |= TLD_DEFER_LEARNING;
+  if (left < cost && have_box && detect_shed<BUDGET_PROBE){
+      degraded |= TLD_LOCAL_DETECTION;
+      roi = Rect(around.x-around.width,around.y-around.height,3*around.width,3*around.height) & Rect(0,0,frame.width,frame.height);
+      if (roi.area()==0 || left <= cost*roi.area()/((double)frame.width*frame.height))
+        degraded |= TLD_TRACK_ONLY;
+  }
 }
 
-void TLD::detect(const cv::Mat& frame){
+void TLD::runDetection(const Mat& img,const Rect& roi,int64 deadline,const Range& scales){
+  int64 t0 = getTickCount();
+  prof.begin(PROF_DETECT);
+  int windows = 0;
+  if (degraded & (TLD_TRACK_ONLY|TLD_INIT_PENDING)){
+      dbb.clear();
+      dconf.clear();
+      dt.bb.clear();
+      tmp.var_pass.clear();
+      detected = false;
+  }
+  else
+    windows = detect(img,roi,deadline,scales);
+  prof.end(PROF_DETECT);
+  double t = (getTickCount()-t0)*1000/getTickFrequency();
+  if (degraded & TLD_INIT_PENDING)
+    return;
+  if (degraded & (TLD_LOCAL_DETECTION|TLD_TRACK_ONLY))
+    detect_shed++;
+  else
+    detect_shed = 0;
+  if (windows==0)
+    return;
+  //A scale gated scan costs a fraction of a full one, each has its own mean.
+  //A local scan counts as the planned scan at its cost per window.
+  double& mean = scales.empty() ? detect_ms : gated_ms;
+  int s0, s1, planned = 0;
+  scaleRange(scales,grid.numScales(),s0,s1);
+  for (int s=s0;s<s1;s++)
+    planned += grid.scale(s).cols*grid.scale(s).rows;
+  t *= planned/(double)windows;
+  //Stopped at the deadline, t is only a lower bound
+  if (degraded & TLD_PARTIAL_NN)
+    t = max(t,mean);
+  mean = mean>0 ? 0.9*mean+0.1*t : t;
+}
+
+//Lattice columns [c0,c1) and rows [r0,r1) of scale g lying inside roi (empty: the whole scale)
+static void windowsInside(const GridScale& g,const Rect& roi,int& c0,int& c1,int& r0,int& r1){
+  c0=0; c1=g.cols; r0=0; r1=g.rows;
+  if (roi.area()==0)
+    return;
+  c0 = max(c0,(int)ceil((roi.x-g.x0)/(float)g.step));
+  c1 = min(c1,(int)floor((roi.br().x-g.size.width-g.x0)/(float)g.step)+1);
+  r0 = max(r0,(int)ceil((roi.y-g.y0)/(float)g.step));
+  r1 = min(r1,(int)floor((roi.br().y-g.size.height-g.y0)/(float)g.step)+1);
+}
+
+//First lattice point origin+i*step at or after pos
+static int firstAnchor(int pos,int origin,int step){
+  int d = pos-origin;
+  return d>0 ? (d+step-1)/step : d/step;
+}
+
+void TLD::windowFeatures(const DetPyramid& pyr,const BoundingBox& w,vector<int>& fern){
+  int l = classifier.getLevel(w.sidx);
+  if (l==0){
+      classifier.getFeatures(pyr.levels[0](w),w.sidx,fern);
+      return;
+  }
+  //Pixels of the level that cover the window
+  Rect r((w.x-pyr.origin.x)>>l,(w.y-pyr.origin.y)>>l,((w.width-1)>>l)+1,((w.height-1)>>l)+1);
+  classifier.getLevelFeatures(pyr.levels[l](r),w.sidx,fern);
+}
+
+Rect TLD::pyramidArea(const Rect& area,const Size& frame) const {
+  int levels = classifier.maxLevel();
+  if (levels==0)
+    return area;
+  //pyrDown reads 2 pixels around each one, per level: with this margin the
+  //levels inside area match those of the whole image
+  int margin = 4<<levels;
+  Rect grown(area.x-margin,area.y-margin,area.width+2*margin,area.height+2*margin);
+  grown = grown & Rect(0,0,frame.width,frame.height);
+  //Aligned to the coarsest level, pixel x of level l is pixel origin.x+(x<<l) of img
+  int align = (1<<levels)-1;
+  Point origin(grown.x&~align,grown.y&~align);
+  return Rect(origin.x,origin.y,grown.br().x-origin.x,grown.br().y-origin.y);
+}
+
+void TLD::buildPyramid(const Mat& img,const Rect& area,DetPyramid& pyr){
+  int levels = classifier.maxLevel();
+  pyr.levels.resize(levels+1);
+  pyr.levels[0] = img;
+  if (levels==0)
+    return;
+  Rect aligned = pyramidArea(area,img.size());
+  pyr.origin = aligned.tl();
+  pyrDown(img(aligned),pyr.levels[1]);
+  for (int l=2;l<=levels;l++)
+    pyrDown(pyr.levels[l-1],pyr.levels[l]);
+}
+
+//Tile side whose blurred pixels and integral image rows (1+4+8 bytes per
+//pixel) fill half of the L2 cache, windows reach beyond their tile
+static int cacheTileSide(){
+  long l2 = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+  if (l2<=0)
+    l2 = 256*1024;
+  return max(16,(int)sqrt(l2/2/13.0));
+}
+
+int TLD::scanScales(const Mat& img,const Rect& roi,const Range& scales){
+  int numtrees = classifier.getNumStructs();
+  float fern_th = classifier.getFernTh();
+  vector <int> ferns(numtrees);
+  float conf;
+  //Variance filter, walking the windows of every scale
+  prof.begin(PROF_VARIANCE);
+  tmp.var_pass.clear();
+  int windows = 0;
+  int s0, s1;
+  scaleRange(scales,grid.numScales(),s0,s1);
+  for (int s=s0;s<s1;s++){//FIXME: BottleNeck
+      const GridScale& g = grid.scale(s);
+      BoundingBox w(Rect(g.x0,g.y0,g.size.width,g.size.height));
+      int c0, c1, r0, r1;
+      windowsInside(g,roi,c0,c1,r0,r1);
+      for (int r=r0;r<r1;r++){
+          w.y = g.y0+r*g.step;
+          int i = g.first+r*g.cols+c0;
+          for (int c=c0;c<c1;c++,i++){
+              w.x = g.x0+c*g.step;
+              windows++;
+              if (getVar(w,iisum,iisqsum)>=var)
+                tmp.var_pass.push_back(i);
+          }
+      }
+  }
+  prof.end(PROF_VARIANCE);
+  //Fern ensemble on the remaining windows
+  prof.begin(PROF_FERNS);
+  int a = tmp.var_pass.size();
+  tmp.conf.resize(a);
+  tmp.patt.resize(a*numtrees);
+  tmp.fern_pass.clear();
+  for (int j=0;j<a;j++){
+      BoundingBox w = grid.window(tmp.var_pass[j]);
+      windowFeatures(pyramid,w,ferns);
+      conf = classifier.measure_forest(ferns);
+      tmp.conf[j]=conf;
+      copy(ferns.begin(),ferns.end(),tmp.patt.begin()+j*numtrees);
+      if (conf>numtrees*fern_th){
+          tmp.fern_pass.push_back(j);
+      }
+  }
+  prof.end(PROF_FERNS);
+  return windows;
+}
+
+int TLD::scanTiled(const Mat& img,const Rect& roi,const Range& scales){
+  int numtrees = classifier.getNumStructs();
+  float fern_th = classifier.getFernTh();
+  vector <int> ferns(numtrees);
+  int side = detect_tile>0 ? detect_tile : cacheTileSide();
+  Rect area = roi.area()>0 ? roi : Rect(0,0,img.cols,img.rows);
+  if ((int)tmp.slot.size()!=grid.size())
+    tmp.slot.assign(grid.size(),-1);
+  //Both filters run in one pass, the variance filter is timed with the ferns
+  prof.begin(PROF_FERNS);
+  tmp.tile_conf.clear();
+  tmp.tile_patt.clear();
+  int windows = 0;
+  int s0, s1;
+  scaleRange(scales,grid.numScales(),s0,s1);
+  for (int ty=area.y;ty<area.br().y;ty+=side){
+      for (int tx=area.x;tx<area.br().x;tx+=side){
+          //Windows of every scale whose top left corner lies in the tile
+          for (int s=s0;s<s1;s++){
+              const GridScale& g = grid.scale(s);
+              int c0, c1, r0, r1;
+              windowsInside(g,roi,c0,c1,r0,r1);
+              c0 = max(c0,firstAnchor(tx,g.x0,g.step));
+              c1 = min(c1,firstAnchor(tx+side,g.x0,g.step));
+              r0 = max(r0,firstAnchor(ty,g.y0,g.step));
+              r1 = min(r1,firstAnchor(ty+side,g.y0,g.step));
+              BoundingBox w(Rect(g.x0,g.y0,g.size.width,g.size.height));
+              w.sidx = s;
+              for (int r=r0;r<r1;r++){
+                  w.y = g.y0+r*g.step;
+                  int i = g.first+r*g.cols+c0;
+                  for (int c=c0;c<c1;c++,i++){
+                      w.x = g.x0+c*g.step;
+                      windows++;
+                      if (getVar(w,iisum,iisqsum)<var)
+                        continue;
+                      windowFeatures(pyramid,w,ferns);
+                      tmp.slot[i] = tmp.tile_conf.size();
+                      tmp.tile_conf.push_back(classifier.measure_forest(ferns));
+                      tmp.tile_patt.insert(tmp.tile_patt.end(),ferns.begin(),ferns.end());
+                  }
+              }
+          }
+      }
+  }
+  //Back to window order, so the candidates and their ties match scanScales
+  int a = tmp.tile_conf.size();
+  tmp.var_pass.resize(a);
+  tmp.conf.resize(a);
+  tmp.patt.resize(a*numtrees);
+  tmp.fern_pass.clear();
+  int j = 0;
+  for (int s=s0;s<s1;s++){
+      const GridScale& g = grid.scale(s);
+      int c0, c1, r0, r1;
+      windowsInside(g,roi,c0,c1,r0,r1);
+      for (int r=r0;r<r1;r++){
+          int i = g.first+r*g.cols+c0;
+          for (int c=c0;c<c1;c++,i++){
+              int k = tmp.slot[i];
+              if (k<0)
+                continue;
+              tmp.slot[i] = -1;
+              tmp.var_pass[j] = i;
+              tmp.conf[j] = tmp.tile_conf[k];
+              copy(tmp.tile_patt.begin()+k*numtrees,tmp.tile_patt.begin()+(k+1)*numtrees,tmp.patt.begin()+j*numtrees);
+              if (tmp.conf[j]>numtrees*fern_th)
+                tmp.fern_pass.push_back(j);
+              j++;
+          }
+      }
+  }
+  prof.end(PROF_FERNS);
+  return windows;
+}
+
+int TLD::detect(const cv::Mat& frame,const cv::Rect& roi,int64 deadline,const cv::Range& scales){
   //cleaning
   dbb.clear();
   dconf.clear();
   dt.bb.clear();
-  double t = (double)getTickCount();
-  Mat img(frame.rows,frame.cols,CV_8U);
+  blurred.create(frame.rows,frame.cols,CV_8U);
+  bool local = roi.area()>0;
+  prof.begin(PROF_INTEGRAL);
   integral(frame,iisum,iisqsum);
-  GaussianBlur(frame,img,Size(9,9),1.5);
+  prof.end(PROF_INTEGRAL);
+  prof.begin(PROF_BLUR);
+  if (local){
+      //Pixels around the ROI are used as the border, the ROI matches a full
+      //blur. Only the pixels the pyramid reads are blurred.
+      Rect area = pyramidArea(roi,frame.size());
+      Mat part = blurred(area);
+      GaussianBlur(frame(area),part,Size(9,9),1.5);
+  }
+  else
+    GaussianBlur(frame,blurred,Size(9,9),1.5);
+  buildPyramid(blurred,local ? roi : Rect(0,0,frame.cols,frame.rows),pyramid);
+  prof.end(PROF_BLUR);
   int numtrees = classifier.getNumStructs();
-  float fern_th = classifier.getFernTh();
-  vector <int> ferns(10);
-  float conf;
-  int a=0;
   Mat patch;
-  for (int i=0;i<grid.size();i++){//FIXME: BottleNeck
-      if (getVar(grid[i],iisum,iisqsum)>=var){
-          a++;
-		  patch = img(grid[i]);
-          classifier.getFeatures(patch,grid[i].sidx,ferns);
-          conf = classifier.measure_forest(ferns);
-          tmp.conf[i]=conf;
-          tmp.patt[i]=ferns;
-          if (conf>numtrees*fern_th){
-              dt.bb.push_back(i);
-          }
-      }
-      else
-        tmp.conf[i]=0.0;
-  }
-  int detections = dt.bb.size();
-  printf("%d Bounding boxes passed the variance filter\n",a);
-  printf("%d Initial detection from Fern Classifier\n",detections);
+  int windows = detect_tile!=0 ? scanTiled(blurred,roi,scales) : scanScales(blurred,roi,scales);
+  if (checker)
+    checker->checkCascade(*this,frame,roi,scales);
+  int a = tmp.var_pass.size();
+  prof.begin(PROF_FERNS);
+  int detections = tmp.fern_pass.size();
+  prof.count(PROF_WINDOWS,windows);
+  prof.count(PROF_PASS_VARIANCE,a);
+  prof.count(PROF_PASS_FERNS,detections);
+  TLD_DEBUG("%d Bounding boxes passed the variance filter",a);
+  TLD_DEBUG("%d Initial detection from Fern Classifier",detections);
   if (detections>100){
-      nth_element(dt.bb.begin(),dt.bb.begin()+100,dt.bb.end(),CComparator(tmp.conf));
-      dt.bb.resize(100);
+      nth_element(tmp.fern_pass.begin(),tmp.fern_pass.begin()+100,tmp.fern_pass.end(),CComparator(tmp.conf));
+      tmp.fern_pass.resize(100);
       detections=100;
   }
+  //With a deadline the best ranked candidates are verified first
+  if (deadline)
+    stable_sort(tmp.fern_pass.begin(),tmp.fern_pass.end(),CComparator(tmp.conf));
+  for (int j=0;j<detections;j++)
+    dt.bb.push_back(tmp.var_pass[tmp.fern_pass[j]]);
+  prof.end(PROF_FERNS);
 //  for (int i=0;i<detections;i++){
-//        drawBox(img,grid[dt.bb[i]]);
+//        drawBox(img,grid.window(dt.bb[i]));
 //    }
 //  imshow("detections",img);
   if (detections==0){
         detected=false;
-        return;
+        return windows;
       }
-  printf("Fern detector made %d detections ",detections);
-  t=(double)getTickCount()-t;
-  printf("in %gms\n", t*1000/getTickFrequency());
+  TLD_DEBUG("Fern detector made %d detections",detections);
                                                                        //  Initialize detection structure
-  dt.patt = vector<vector<int> >(detections,vector<int>(10,0));        //  Corresponding codes of the Ensemble Classifier
+  dt.patt = vector<vector<int> >(detections);                          //  Corresponding codes of the Ensemble Classifier
   dt.conf1 = vector<float>(detections);                                //  Relative Similarity (for final nearest neighbour classifier)
   dt.conf2 =vector<float>(detections);                                 //  Conservative Similarity (for integration with tracker)
   dt.isin = vector<vector<int> >(detections,vector<int>(3,-1));        //  Detected (isin=1) or rejected (isin=0) by nearest neighbour classifier
   dt.patch = vector<Mat>(detections,Mat(patch_size,patch_size,CV_32F));//  Corresponding patches
-  int idx;
+  BoundingBox box;
   Scalar mean, stdev;
   float nn_th = classifier.getNNTh();
+  ProfScope scope(prof,PROF_NN);
   for (int i=0;i<detections;i++){                                         //  for every remaining detection
-      idx=dt.bb[i];                                                       //  Get the detected bounding box index
-	  patch = frame(grid[idx]);
+      if (deadline && i>0 && getTickCount()>deadline){
+          degraded |= TLD_PARTIAL_NN;
+          TLD_DEBUG("Deadline: %d of %d candidates verified",i,detections);
+          dt.bb.resize(i);
+          dt.patt.resize(i);
+          dt.conf1.resize(i);
+          dt.conf2.resize(i);
+          dt.isin.resize(i);
+          dt.patch.resize(i);
+          break;
+      }
+      box = grid.window(dt.bb[i]);                                        //  Get the detected bounding box
+	  patch = frame(box);
       getPattern(patch,dt.patch[i],mean,stdev);                //  Get pattern within bounding box
       classifier.NNConf(dt.patch[i],dt.isin[i],dt.conf1[i],dt.conf2[i]);  //  Evaluate nearest neighbour classifier
-      dt.patt[i]=tmp.patt[idx];
+      vector<int>::const_iterator code = tmp.patt.begin()+tmp.fern_pass[i]*numtrees;
+      dt.patt[i].assign(code,code+numtrees);
       //printf("Testing feature %d, conf:%f isin:(%d|%d|%d)\n",i,dt.conf1[i],dt.isin[i][0],dt.isin[i][1],dt.isin[i][2]);
       if (dt.conf1[i]>nn_th){                                               //  idx = dt.conf1 > tld.model.thr_nn; % get all indexes that made it through the nearest neighbour
-          dbb.push_back(grid[idx]);                                         //  BB    = dt.bb(:,idx); % bounding boxes
+          dbb.push_back(box);                                               //  BB    = dt.bb(:,idx); % bounding boxes
           dconf.push_back(dt.conf2[i]);                                     //  Conf  = dt.conf2(:,idx); % conservative confidences
       }
   }                                                                         //  end
+  if (checker)
+    checker->checkNN(*this);
+  prof.count(PROF_PASS_NN,dbb.size());
   if (dbb.size()>0){
-      printf("Found %d NN matches\n",(int)dbb.size());
+      TLD_DEBUG("Found %d NN matches",(int)dbb.size());
       detected=true;
   }
   else{
-      printf("No NN matches found.\n");
+      TLD_DEBUG("No NN matches found.");
       detected=false;
   }
+  return windows;
 }
 
 void TLD::evaluate(){
 }
 
 void TLD::learn(const Mat& img){
-  printf("[Learning] ");
   ///Check consistency
   BoundingBox bb;
   bb.x = max(lastbox.x,0);
@@ -509,42 +1146,45 @@ void TLD::learn(const Mat& img){
   float dummy, conf;
   classifier.NNConf(pattern,isin,conf,dummy);
   if (conf<0.5) {
-      printf("Fast change..not training\n");
+      TLD_DEBUG("[Learning] Fast change..not training");
       lastvalid =false;
       return;
   }
   if (pow(stdev.val[0],2)<var){
-      printf("Low variance..not training\n");
+      TLD_DEBUG("[Learning] Low variance..not training");
       lastvalid=false;
       return;
   }
   if(isin[2]==1){
-      printf("Patch in negative data..not traing");
+      TLD_DEBUG("[Learning] Patch in negative data..not traing");
       lastvalid=false;
       return;
   }
 /// Data generation
-  for (int i=0;i<grid.size();i++){
-      grid[i].overlap = bbOverlap(lastbox,grid[i]);
-  }
-  vector<pair<vector<int>,int> > fern_examples;
-  good_boxes.clear();
-  bad_boxes.clear();
+  FernTrainingSet fern_examples;
   getOverlappingBoxes(lastbox,num_closest_update);
-  if (good_boxes.size()>0)
-    generatePositiveData(img,num_warps_update);
+  if (good_boxes.size()>0){
+      ProfScope scope(prof,PROF_WARPS);
+      generatePositiveData(img,num_warps_update);
+  }
   else{
     lastvalid = false;
-    printf("No good boxes..Not training");
+    TLD_DEBUG("[Learning] No good boxes..Not training");
     return;
   }
-  fern_examples.reserve(pX.size()+bad_boxes.size());
-  fern_examples.assign(pX.begin(),pX.end());
+  prof.begin(PROF_NEGATIVES);
+  fern_examples = pX;
+  //Bad boxes come from the windows the detector scored, the rest of the grid
+  //has conf 0 (only windows past the variance filter can have conf>=1)
   int idx;
-  for (int i=0;i<bad_boxes.size();i++){
-      idx=bad_boxes[i];
-      if (tmp.conf[idx]>=1){
-          fern_examples.push_back(make_pair(tmp.patt[idx],0));
+  float o;
+  int numtrees = classifier.getNumStructs();
+  for (int j=0;j<tmp.var_pass.size();j++){
+      if (tmp.conf[j]<1)
+        continue;
+      o = bbOverlap(lastbox,grid.window(tmp.var_pass[j]));
+      if (!(o>0.6) && o<bad_overlap){
+          fern_examples.add(&tmp.patt[j*numtrees],0);
       }
   }
   vector<Mat> nn_examples;
@@ -552,82 +1192,44 @@ void TLD::learn(const Mat& img){
   nn_examples.push_back(pEx);
   for (int i=0;i<dt.bb.size();i++){
       idx = dt.bb[i];
-      if (bbOverlap(lastbox,grid[idx]) < bad_overlap)
+      if (bbOverlap(lastbox,grid.window(idx)) < bad_overlap)
         nn_examples.push_back(dt.patch[i]);
   }
+  prof.end(PROF_NEGATIVES);
   /// Classifiers update
+  prof.begin(PROF_TRAIN_FERNS);
   classifier.trainF(fern_examples,2);
+  prof.end(PROF_TRAIN_FERNS);
+  prof.begin(PROF_TRAIN_NN);
   classifier.trainNN(nn_examples);
-  classifier.show();
+  prof.end(PROF_TRAIN_NN);
+  if (show_examples)
+    classifier.show();
 }
 
 void TLD::buildGrid(const cv::Mat& img, const cv::Rect& box){
-  const float SHIFT = 0.1;
-  const float SCALES[] = {0.16151,0.19381,0.23257,0.27908,0.33490,0.40188,0.48225,
-                          0.57870,0.69444,0.83333,1,1.20000,1.44000,1.72800,
-                          2.07360,2.48832,2.98598,3.58318,4.29982,5.15978,6.19174};
-  int width, height, min_bb_side;
-  //Rect bbox;
-  BoundingBox bbox;
-  Size scale;
-  int sc=0;
-  for (int s=0;s<21;s++){
-    width = round(box.width*SCALES[s]);
-    height = round(box.height*SCALES[s]);
-    min_bb_side = min(height,width);
-    if (min_bb_side < min_win || width > img.cols || height > img.rows)
-      continue;
-    scale.width = width;
-    scale.height = height;
-    scales.push_back(scale);
-    for (int y=1;y<img.rows-height;y+=round(SHIFT*min_bb_side)){
-      for (int x=1;x<img.cols-width;x+=round(SHIFT*min_bb_side)){
-        bbox.x = x;
-        bbox.y = y;
-        bbox.width = width;
-        bbox.height = height;
-        bbox.overlap = bbOverlap(bbox,BoundingBox(box));
-        bbox.sidx = sc;
-        grid.push_back(bbox);
-      }
-    }
-    sc++;
-  }
+  grid.build(img.size(),box,min_win,grid_shift,scale_step,num_scales);
 }
 
 float TLD::bbOverlap(const BoundingBox& box1,const BoundingBox& box2){
-  if (box1.x > box2.x+box2.width) { return 0.0; }
-  if (box1.y > box2.y+box2.height) { return 0.0; }
-  if (box1.x+box1.width < box2.x) { return 0.0; }
-  if (box1.y+box1.height < box2.y) { return 0.0; }
-
-  float colInt =  min(box1.x+box1.width,box2.x+box2.width) - max(box1.x, box2.x);
-  float rowInt =  min(box1.y+box1.height,box2.y+box2.height) - max(box1.y,box2.y);
-
-  float intersection = colInt * rowInt;
-  float area1 = box1.width*box1.height;
-  float area2 = box2.width*box2.height;
-  return intersection / (area1 + area2 - intersection);
+  return ::bbOverlap(box1,box2);
 }
 
 void TLD::getOverlappingBoxes(const cv::Rect& box1,int num_closest){
-  float max_overlap = 0;
-  for (int i=0;i<grid.size();i++){
-      if (grid[i].overlap > max_overlap) {
-          max_overlap = grid[i].overlap;
-          best_box = grid[i];
-      }
-      if (grid[i].overlap > 0.6){
-          good_boxes.push_back(i);
-      }
-      else if (grid[i].overlap < bad_overlap){
-          bad_boxes.push_back(i);
-      }
-  }
+  float max_overlap;
+  int best = grid.closest(box1,max_overlap);
+  if (best>=0)
+    best_box = grid.window(best);
+  grid.overlapping(box1,0.6,good_boxes,good_overlap);
   //Get the best num_closest (10) boxes and puts them in good_boxes
   if (good_boxes.size()>num_closest){
-    std::nth_element(good_boxes.begin(),good_boxes.begin()+num_closest,good_boxes.end(),OComparator(grid));
-    good_boxes.resize(num_closest);
+    vector<int> order(good_boxes.size());
+    for (int i=0;i<order.size();i++)
+      order[i]=i;
+    std::nth_element(order.begin(),order.begin()+num_closest,order.end(),OComparator(good_overlap));
+    for (int i=0;i<num_closest;i++)
+      order[i]=good_boxes[order[i]];
+    good_boxes.assign(order.begin(),order.begin()+num_closest);
   }
   getBBHull();
 }
@@ -635,13 +1237,13 @@ void TLD::getOverlappingBoxes(const cv::Rect& box1,int num_closest){
 void TLD::getBBHull(){
   int x1=INT_MAX, x2=0;
   int y1=INT_MAX, y2=0;
-  int idx;
+  BoundingBox box;
   for (int i=0;i<good_boxes.size();i++){
-      idx= good_boxes[i];
-      x1=min(grid[idx].x,x1);
-      y1=min(grid[idx].y,y1);
-      x2=max(grid[idx].x+grid[idx].width,x2);
-      y2=max(grid[idx].y+grid[idx].height,y2);
+      box = grid.window(good_boxes[i]);
+      x1=min(box.x,x1);
+      y1=min(box.y,y1);
+      x2=max(box.x+box.width,x2);
+      y2=max(box.y+box.height,y2);
   }
   bbhull.x = x1;
   bbhull.y = y1;
@@ -649,129 +1251,7 @@ void TLD::getBBHull(){
   bbhull.height = y2 -y1;
 }
 
-bool bbcomp(const BoundingBox& b1,const BoundingBox& b2){
-  TLD t;
-    if (t.bbOverlap(b1,b2)<0.5)
-      return false;
-    else
-      return true;
-}
-int TLD::clusterBB(const vector<BoundingBox>& dbb,vector<int>& indexes){
-  //FIXME: Conditional jump or move depends on uninitialised value(s)
-  const int c = dbb.size();
-  //1. Build proximity matrix
-  Mat D(c,c,CV_32F);
-  float d;
-  for (int i=0;i<c;i++){
-      for (int j=i+1;j<c;j++){
-        d = 1-bbOverlap(dbb[i],dbb[j]);
-        D.at<float>(i,j) = d;
-        D.at<float>(j,i) = d;
-      }
-  }
-  //2. Initialize disjoint clustering
- float L[c-1]; //Level
- int nodes[c-1][2];
- int belongs[c];
- int m=c;
- for (int i=0;i<c;i++){
-    belongs[i]=i;
- }
- for (int it=0;it<c-1;it++){
- //3. Find nearest neighbor
-     float min_d = 1;
-     int node_a, node_b;
-     for (int i=0;i<D.rows;i++){
-         for (int j=i+1;j<D.cols;j++){
-             if (D.at<float>(i,j)<min_d && belongs[i]!=belongs[j]){
-                 min_d = D.at<float>(i,j);
-                 node_a = i;
-                 node_b = j;
-             }
-         }
-     }
-     if (min_d>0.5){
-         int max_idx =0;
-         bool visited;
-         for (int j=0;j<c;j++){
-             visited = false;
-             for(int i=0;i<2*c-1;i++){
-                 if (belongs[j]==i){
-                     indexes[j]=max_idx;
-                     visited = true;
-                 }
-             }
-             if (visited)
-               max_idx++;
-         }
-         return max_idx;
-     }
-
- //4. Merge clusters and assign level
-     L[m]=min_d;
-     nodes[it][0] = belongs[node_a];
-     nodes[it][1] = belongs[node_b];
-     for (int k=0;k<c;k++){
-         if (belongs[k]==belongs[node_a] || belongs[k]==belongs[node_b])
-           belongs[k]=m;
-     }
-     m++;
- }
- return 1;
-
-}
-
 void TLD::clusterConf(const vector<BoundingBox>& dbb,const vector<float>& dconf,vector<BoundingBox>& cbb,vector<float>& cconf){
-  int numbb =dbb.size();
-  vector<int> T;
-  float space_thr = 0.5;
-  int c=1;
-  switch (numbb){
-  case 1:
-    cbb=vector<BoundingBox>(1,dbb[0]);
-    cconf=vector<float>(1,dconf[0]);
-    return;
-    break;
-  case 2:
-    T =vector<int>(2,0);
-    if (1-bbOverlap(dbb[0],dbb[1])>space_thr){
-      T[1]=1;
-      c=2;
-    }
-    break;
-  default:
-    T = vector<int>(numbb,0);
-    c = partition(dbb,T,(*bbcomp));
-    //c = clusterBB(dbb,T);
-    break;
-  }
-  cconf=vector<float>(c);
-  cbb=vector<BoundingBox>(c);
-  printf("Cluster indexes: ");
-  BoundingBox bx;
-  for (int i=0;i<c;i++){
-      float cnf=0;
-      int N=0,mx=0,my=0,mw=0,mh=0;
-      for (int j=0;j<T.size();j++){
-          if (T[j]==i){
-              printf("%d ",i);
-              cnf=cnf+dconf[j];
-              mx=mx+dbb[j].x;
-              my=my+dbb[j].y;
-              mw=mw+dbb[j].width;
-              mh=mh+dbb[j].height;
-              N++;
-          }
-      }
-      if (N>0){
-          cconf[i]=cnf/N;
-          bx.x=cvRound(mx/N);
-          bx.y=cvRound(my/N);
-          bx.width=cvRound(mw/N);
-          bx.height=cvRound(mh/N);
-          cbb[i]=bx;
-      }
-  }
-  printf("\n");
+  clusterer.cluster(dbb,dconf,cbb,cconf);
 }
 
@@ -0,0 +1,73 @@
+/*
+ * TLDSession.cpp
+ */
+
+#include <TLDSession.h>
+#include <tld_log.h>
+using namespace cv;
+using namespace std;
+
+TLDSession::TLDSession(const FileNode& params)
+: tld(params),current(0),initialized(false),learning(true),sink(NULL){
+}
+
+TLDSession::TLDSession(const string& params_file)
+: current(0),initialized(false),learning(true),sink(NULL){
+  FileStorage fs(params_file,FileStorage::READ);
+  if (!fs.isOpened())
+    TLD_ERROR("Could not read parameters %s",params_file.c_str());
+  tld.read(fs.getFirstTopLevelNode());
+}
+
+void TLDSession::keepFrame(const Mat& gray,bool borrow){
+  if (borrow){
+      last = gray;
+      return;
+  }
+  //Alternate between two buffers, the previous frame stays valid
+  current = 1-current;
+  gray.copyTo(buffers[current]);
+  last = buffers[current];
+}
+
+const TLDResult& TLDSession::init(const Mat& gray,const Rect& box,bool borrow){
+  CV_Assert(gray.type()==CV_8U);
+  keepFrame(gray,borrow);
+  tld.init(last,box,res);
+  initialized = true;
+  if (sink)
+    sink->write(res.record());
+  return res;
+}
+
+bool TLDSession::loadModel(const string& path,const Mat& gray,const Rect& box,bool borrow){
+  CV_Assert(gray.type()==CV_8U);
+  keepFrame(gray,borrow);
+  initialized = tld.loadModel(path,last,box,res);
+  if (initialized && sink)
+    sink->write(res.record());
+  return initialized;
+}
+
+bool TLDSession::saveModel(const string& path){
+  return initialized && tld.saveModel(path);
+}
+
+const TLDResult& TLDSession::process(const Mat& gray,bool borrow){
+  if (!initialized){
+      TLD_WARN("process() called before init()");
+      res.found = false;
+      return res;
+  }
+  CV_Assert(gray.type()==CV_8U && gray.size()==last.size());
+  Mat previous = last;
+  keepFrame(gray,borrow);
+  tld.processFrame(previous,last,res,learning);
+  if (sink)
+    sink->write(res.record());
+  return res;
+}
+
+const TLDResult& TLDSession::process(const uchar* data,int width,int height,size_t step){
+  return process(Mat(height,width,CV_8U,(void*)data,step),true);
+}
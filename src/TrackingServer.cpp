@@ -0,0 +1,244 @@
+/*
+ * TrackingServer.cpp
+ */
+
+#include <TrackingServer.h>
+#include <FrameSource.h>
+#include <ResultSink.h>
+#include <tld_log.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+using namespace cv;
+using namespace std;
+
+struct QueuedFrame {
+  Mat gray;
+  int64 time;           //tick count when read
+};
+
+struct TrackingServer::Stream {
+  Stream(const FileNode& params,const StreamSpec& _spec):spec(_spec),session(params),sink(NULL),
+      eof(false),busy(false),vtime(0){
+    memset(&stats,0,sizeof(stats));
+  }
+  StreamSpec spec;
+  TLDSession session;
+  ResultSink* sink;
+  thread reader;
+  deque<QueuedFrame> queue;
+  bool eof;             //the reader is done
+  bool busy;            //a worker is processing a frame
+  double vtime;         //busy time divided by priority
+  StreamStats stats;
+};
+
+static double elapsedMs(int64 t0,int64 t1){
+  return (t1-t0)*1000.0/getTickFrequency();
+}
+
+bool readStreamList(const string& path,vector<StreamSpec>& specs){
+  ifstream file(path.c_str());
+  if (!file.is_open())
+    return false;
+  string line;
+  int n = 0;
+  while (getline(file,line)){
+      n++;
+      size_t hash = line.find('#');
+      if (hash!=string::npos)
+        line.erase(hash);
+      istringstream fields(line);
+      StreamSpec spec;
+      if (!(fields >> spec.name))
+        continue;
+      if (!(fields >> spec.source >> spec.box.x >> spec.box.y >> spec.box.width >> spec.box.height)){
+          printf("%s:%d: expected name source x y width height [priority]\n",path.c_str(),n);
+          return false;
+      }
+      if (!(fields >> spec.priority) || spec.priority<1)
+        spec.priority = 1;
+      specs.push_back(spec);
+  }
+  return true;
+}
+
+//raw:WIDTHxHEIGHT:path
+static bool parseRaw(const string& source,Size& size,string& path){
+  if (source.compare(0,4,"raw:")!=0)
+    return false;
+  size_t colon = source.find(':',4);
+  if (colon==string::npos || sscanf(source.c_str()+4,"%dx%d",&size.width,&size.height)!=2)
+    return false;
+  path = source.substr(colon+1);
+  return size.width>0 && size.height>0;
+}
+
+TrackingServer::TrackingServer(const FileNode& _params,const ServerOptions& _opt)
+: params(_params),opt(_opt),vtime(0){
+  if (opt.workers<=0)
+    opt.workers = max(1u,thread::hardware_concurrency());
+  if (opt.max_queue<1)
+    opt.max_queue = 1;
+}
+
+TrackingServer::~TrackingServer(){
+  for (size_t i=0;i<streams.size();i++){
+      if (streams[i]->reader.joinable())
+        streams[i]->reader.join();
+      delete streams[i]->sink;
+      delete streams[i];
+  }
+}
+
+void TrackingServer::addStream(const StreamSpec& spec){
+  Stream* s = new Stream(params,spec);
+  s->session.setLearning(opt.learning);
+  if (!opt.output.empty()){
+      s->sink = new CsvResultSink(opt.output+"/"+spec.name+".txt");
+      s->session.setSink(s->sink);
+  }
+  streams.push_back(s);
+}
+
+const StreamSpec& TrackingServer::spec(int s) const {
+  return streams[s]->spec;
+}
+
+StreamStats TrackingServer::stats(int s){
+  lock_guard<mutex> lock(mtx);
+  return streams[s]->stats;
+}
+
+void TrackingServer::push(Stream& s,const Mat& gray){
+  QueuedFrame f;
+  gray.copyTo(f.gray);
+  f.time = getTickCount();
+  lock_guard<mutex> lock(mtx);
+  s.stats.decoded++;
+  if ((int)s.queue.size()>=opt.max_queue){
+      //The first frame initializes the session and is never dropped
+      bool first_waiting = s.stats.processed==0 && !s.busy;
+      s.stats.dropped++;
+      if (first_waiting && s.queue.size()==1)
+        return;
+      s.queue.erase(s.queue.begin()+(first_waiting ? 1 : 0));
+  }
+  //A stream that was starved of frames rejoins at the current virtual time
+  if (s.queue.empty() && !s.busy)
+    s.vtime = max(s.vtime,vtime);
+  s.queue.push_back(f);
+  cv_work.notify_one();
+}
+
+void TrackingServer::read(Stream& s){
+  Size raw_size;
+  string raw_path;
+  Mat gray;
+  int64 start = getTickCount();
+  int frames = 0;
+  if (parseRaw(s.spec.source,raw_size,raw_path)){
+      FILE* file = raw_path=="-" ? stdin : fopen(raw_path.c_str(),"rb");
+      if (!file)
+        TLD_ERROR("[%s] could not open %s",s.spec.name.c_str(),raw_path.c_str());
+      gray.create(raw_size,CV_8U);
+      while (file && fread(gray.data,raw_size.area(),1,file)==1)
+        push(s,gray);
+      if (file && file!=stdin)
+        fclose(file);
+  }
+  else {
+      FrameSource source;
+      if (!source.open(s.spec.source))
+        TLD_ERROR("[%s] could not open %s",s.spec.name.c_str(),s.spec.source.c_str());
+      while (source.isOpened() && source.read(gray)){
+          push(s,gray);
+          frames++;
+          if (opt.fps>0){
+              double due = frames*1000.0/opt.fps-elapsedMs(start,getTickCount());
+              if (due>0)
+                this_thread::sleep_for(chrono::microseconds((int64)(due*1000)));
+          }
+      }
+  }
+  lock_guard<mutex> lock(mtx);
+  s.eof = true;
+  cv_work.notify_all();
+}
+
+//Runnable stream with the least virtual time, NULL when every stream is done
+TrackingServer::Stream* TrackingServer::next(){
+  unique_lock<mutex> lock(mtx);
+  while (true){
+      Stream* best = NULL;
+      bool running = false;
+      for (size_t i=0;i<streams.size();i++){
+          Stream* s = streams[i];
+          if (!s->eof || s->busy || !s->queue.empty())
+            running = true;
+          if (s->busy || s->queue.empty())
+            continue;
+          if (!best || s->vtime<best->vtime)
+            best = s;
+      }
+      if (best){
+          best->busy = true;
+          vtime = best->vtime;
+          return best;
+      }
+      if (!running)
+        return NULL;
+      cv_work.wait(lock);
+  }
+}
+
+void TrackingServer::work(){
+  Stream* s;
+  while ((s = next())!=NULL){
+      QueuedFrame f;
+      {
+        lock_guard<mutex> lock(mtx);
+        //Skip to the newest frame within max_age_ms
+        int64 now = getTickCount();
+        while (opt.max_age_ms>0 && s->queue.size()>1 && s->session.isInitialized() &&
+            elapsedMs(s->queue.front().time,now)>opt.max_age_ms){
+            s->queue.pop_front();
+            s->stats.dropped++;
+        }
+        f = s->queue.front();
+        s->queue.pop_front();
+      }
+      int64 t0 = getTickCount();
+      const TLDResult& r = s->session.isInitialized() ? s->session.process(f.gray,true)
+                                                      : s->session.init(f.gray,s->spec.box,true);
+      bool found = r.found;
+      int64 t1 = getTickCount();
+      lock_guard<mutex> lock(mtx);
+      double busy = elapsedMs(t0,t1);
+      double latency = elapsedMs(f.time,t1);
+      s->busy = false;
+      s->vtime += busy/s->spec.priority;
+      s->stats.processed++;
+      s->stats.found += found;
+      s->stats.busy_ms += busy;
+      s->stats.latency_ms += latency;
+      s->stats.max_latency_ms = max(s->stats.max_latency_ms,latency);
+      cv_work.notify_all();
+  }
+}
+
+void TrackingServer::run(){
+  for (size_t i=0;i<streams.size();i++)
+    streams[i]->reader = thread(&TrackingServer::read,this,ref(*streams[i]));
+  vector<thread> workers;
+  for (int w=0;w<opt.workers;w++)
+    workers.push_back(thread(&TrackingServer::work,this));
+  for (size_t w=0;w<workers.size();w++)
+    workers[w].join();
+  for (size_t i=0;i<streams.size();i++){
+      streams[i]->reader.join();
+      if (streams[i]->sink)
+        streams[i]->sink->flush();
+  }
+}
@@ -0,0 +1,192 @@
+/*
+ * WindowGrid.cpp
+ */
+
+#include <WindowGrid.h>
+#include <tld_utils.h>
+using namespace cv;
+using namespace std;
+
+void WindowGrid::clear(){
+  scales.clear();
+  total = 0;
+}
+
+void WindowGrid::build(const Size& frame,const Rect& box,int min_win,float shift,float scale_step,int num_scales){
+  const float SHIFT = 0.1;
+  const float SCALES[] = {0.16151,0.19381,0.23257,0.27908,0.33490,0.40188,0.48225,
+                          0.57870,0.69444,0.83333,1,1.20000,1.44000,1.72800,
+                          2.07360,2.48832,2.98598,3.58318,4.29982,5.15978,6.19174};
+  if (shift<=0)
+    shift = SHIFT;
+  //The table keeps the default windows identical to the original grid
+  bool table = (scale_step<=0 || scale_step==1.2f) && (num_scales<=0 || num_scales==21);
+  if (scale_step<=0)
+    scale_step = 1.2;
+  if (num_scales<=0)
+    num_scales = 21;
+  int width, height, min_bb_side;
+  clear();
+  box_size = box.size();
+  for (int s=0;s<num_scales;s++){
+    float scale = table ? SCALES[s] : pow(scale_step,(float)(s-(num_scales-1)/2));
+    width = round(box.width*scale);
+    height = round(box.height*scale);
+    min_bb_side = min(height,width);
+    if (min_bb_side < min_win || width > frame.width || height > frame.height)
+      continue;
+    //Same windows as for (y=1;y<rows-height;y+=step) for (x=1;x<cols-width;x+=step)
+    GridScale g;
+    g.size = Size(width,height);
+    g.x0 = 1;
+    g.y0 = 1;
+    g.step = max(1,(int)round(shift*min_bb_side));
+    g.cols = frame.width-width>1 ? (frame.width-width-1+g.step-1)/g.step : 0;
+    g.rows = frame.height-height>1 ? (frame.height-height-1+g.step-1)/g.step : 0;
+    if (g.cols==0 || g.rows==0)
+      g.cols = g.rows = 0;
+    g.first = total;
+    total += g.count();
+    scales.push_back(g);
+  }
+}
+
+vector<Size> WindowGrid::scaleSizes() const {
+  vector<Size> sizes(scales.size());
+  for (size_t s=0;s<scales.size();s++)
+    sizes[s] = scales[s].size;
+  return sizes;
+}
+
+int WindowGrid::scaleOf(int idx) const {
+  //Few scales (21 by default), the last one whose first window is <= idx
+  int s = scales.size()-1;
+  while (s>0 && scales[s].first>idx)
+    s--;
+  return s;
+}
+
+int WindowGrid::nearestScale(const Size& size) const {
+  int best = -1;
+  double best_d = 0;
+  for (size_t s=0;s<scales.size();s++){
+      double d = fabs(log((double)scales[s].size.area()/max(1,size.area())));
+      if (best<0 || d<best_d){
+          best = s;
+          best_d = d;
+      }
+  }
+  return best;
+}
+
+//Overlap >= t needs intersection >= t*max(area), so the intersection width
+//is at least m = t*max(area)/min(height): x in [bx+m-w, bx+bw-m]
+static void latticeRange(int origin,int step,int count,int size,int bpos,int bsize,float m,int& lo,int& hi){
+  lo = (int)floor((bpos+m-size-origin)/(float)step);
+  hi = (int)floor((bpos+bsize-m-origin)/(float)step)+1;
+  lo = max(lo-1,0);  //one spare point either side for rounding
+  hi = min(hi+1,count);
+}
+
+bool WindowGrid::candidates(const GridScale& g,const Rect& box,float min_overlap,int& c0,int& c1,int& r0,int& r1) const {
+  //Slightly loose, overlaps are compared in float
+  float min_area = min_overlap*0.9999f*max(g.size.area(),box.area());
+  float mx = min_area/min(g.size.height,box.height);
+  float my = min_area/min(g.size.width,box.width);
+  if (g.count()==0 || mx>min(g.size.width,box.width) || my>min(g.size.height,box.height))
+    return false;
+  latticeRange(g.x0,g.step,g.cols,g.size.width,box.x,box.width,mx,c0,c1);
+  latticeRange(g.y0,g.step,g.rows,g.size.height,box.y,box.height,my,r0,r1);
+  return c0<c1 && r0<r1;
+}
+
+void WindowGrid::overlapping(const Rect& box,double min_overlap,vector<int>& idx,vector<float>& overlap) const {
+  idx.clear();
+  overlap.clear();
+  int c0,c1,r0,r1;
+  float o;
+  for (size_t s=0;s<scales.size();s++){
+      const GridScale& g = scales[s];
+      if (!candidates(g,box,min_overlap,c0,c1,r0,r1))
+        continue;
+      Rect w(0,0,g.size.width,g.size.height);
+      for (int r=r0;r<r1;r++){
+          w.y = g.y0+r*g.step;
+          for (int c=c0;c<c1;c++){
+              w.x = g.x0+c*g.step;
+              o = bbOverlap(w,box);
+              if (o>min_overlap){
+                  idx.push_back(g.first+r*g.cols+c);
+                  overlap.push_back(o);
+              }
+          }
+      }
+  }
+}
+
+void WindowGrid::farFrom(const Rect& box,float max_overlap,vector<int>& idx) const {
+  idx.clear();
+  if (max_overlap<=0)
+    return;
+  idx.reserve(total);
+  int c0,c1,r0,r1;
+  for (size_t s=0;s<scales.size();s++){
+      const GridScale& g = scales[s];
+      //Outside the candidate rectangle the overlap is below max_overlap
+      if (!candidates(g,box,max_overlap,c0,c1,r0,r1))
+        c0 = c1 = r0 = r1 = 0;
+      Rect w(0,0,g.size.width,g.size.height);
+      for (int r=0;r<g.rows;r++){
+          int i = g.first+r*g.cols;
+          if (r<r0 || r>=r1){
+              for (int c=0;c<g.cols;c++)
+                idx.push_back(i+c);
+              continue;
+          }
+          w.y = g.y0+r*g.step;
+          for (int c=0;c<g.cols;c++){
+              if (c>=c0 && c<c1){
+                  w.x = g.x0+c*g.step;
+                  if (bbOverlap(w,box)>=max_overlap)
+                    continue;
+              }
+              idx.push_back(i+c);
+          }
+      }
+  }
+}
+
+//Lowest lattice position of maximum intersection with [bpos,bpos+bsize):
+//the intersection is flat between bpos and bpos+bsize-size and falls off linearly
+static int bestOnLattice(int origin,int step,int count,int size,int bpos,int bsize){
+  int lo = min(bpos,bpos+bsize-size);
+  int hi = max(bpos,bpos+bsize-size);
+  int k = (int)ceil((lo-origin)/(float)step);  //first lattice point >= lo
+  if (k<=0)
+    return 0;
+  if (k>=count)
+    return count-1;
+  int x = origin+k*step;
+  if (x>hi && lo-(x-step) <= x-hi)  //past the plateau and the point below is as close
+    return k-1;
+  return k;
+}
+
+int WindowGrid::closest(const Rect& box,float& overlap) const {
+  int best = -1;
+  overlap = 0;
+  float o;
+  for (size_t s=0;s<scales.size();s++){
+      const GridScale& g = scales[s];
+      if (g.count()==0)
+        continue;
+      int c = bestOnLattice(g.x0,g.step,g.cols,g.size.width,box.x,box.width);
+      int r = bestOnLattice(g.y0,g.step,g.rows,g.size.height,box.y,box.height);
+      o = bbOverlap(Rect(g.x0+c*g.step,g.y0+r*g.step,g.size.width,g.size.height),box);
+      if (o>overlap){
+          overlap = o;
+          best = g.first+r*g.cols+c;
+      }
+  }
+  return best;
+}
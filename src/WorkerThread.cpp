@@ -0,0 +1,49 @@
+/*
+ * WorkerThread.cpp
+ */
+
+#include <WorkerThread.h>
+using namespace std;
+
+WorkerThread::~WorkerThread(){
+  if (!worker.joinable())
+    return;
+  {
+    lock_guard<mutex> lock(mtx);
+    stop = true;
+  }
+  cv_job.notify_one();
+  worker.join();
+}
+
+void WorkerThread::run(const function<void()>& _job){
+  {
+    lock_guard<mutex> lock(mtx);
+    job = _job;
+    busy = true;
+  }
+  if (!worker.joinable())
+    worker = thread(&WorkerThread::loop,this);
+  cv_job.notify_one();
+}
+
+void WorkerThread::wait(){
+  unique_lock<mutex> lock(mtx);
+  while (busy)
+    cv_done.wait(lock);
+}
+
+void WorkerThread::loop(){
+  unique_lock<mutex> lock(mtx);
+  while (true){
+      while (!busy && !stop)
+        cv_job.wait(lock);
+      if (!busy)
+        return;
+      lock.unlock();
+      job();
+      lock.lock();
+      busy = false;
+      cv_done.notify_all();
+  }
+}
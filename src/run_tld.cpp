@@ -1,21 +1,32 @@
 #include <opencv2/opencv.hpp>
 #include <tld_utils.h>
+#include <tld_log.h>
 #include <iostream>
 #include <sstream>
-#include <TLD.h>
+#include <TLDSession.h>
+#include <FrameSource.h>
+#include <CpuFeatures.h>
 #include <stdio.h>
 using namespace cv;
 using namespace std;
-//Global variables
-Rect box;
-bool drawing_box = false;
-bool gotBB = false;
-bool tl = false;
-bool rep = false;
-bool fromfile=false;
-string video;
+//Command line options and initial box selection
+struct Options {
+  Options():drawing_box(false),gotBB(false),tl(false),rep(false),fromfile(false),cache(false),binout(false){}
+  Rect box;
+  bool drawing_box;
+  bool gotBB;
+  bool tl;
+  bool rep;
+  bool fromfile;
+  bool cache;
+  bool binout;
+  string video;
+  string model_in;
+  string model_out;
+  string trace;
+};
 
-void readBB(char* file){
+Rect readBB(char* file){
   ifstream bb_file (file);
   string line;
   getline(bb_file,line);
@@ -29,56 +40,63 @@ void readBB(char* file){
   int y = atoi(y1.c_str());// = (int)file["bb_y"];
   int w = atoi(x2.c_str())-x;// = (int)file["bb_w"];
   int h = atoi(y2.c_str())-y;// = (int)file["bb_h"];
-  box = Rect(x,y,w,h);
+  return Rect(x,y,w,h);
 }
-//bounding box mouse callback
+//bounding box mouse callback, param is the Options being filled
 void mouseHandler(int event, int x, int y, int flags, void *param){
+  Options& opt = *(Options*)param;
   switch( event ){
   case CV_EVENT_MOUSEMOVE:
-    if (drawing_box){
-        box.width = x-box.x;
-        box.height = y-box.y;
+    if (opt.drawing_box){
+        opt.box.width = x-opt.box.x;
+        opt.box.height = y-opt.box.y;
     }
     break;
   case CV_EVENT_LBUTTONDOWN:
-    drawing_box = true;
-    box = Rect( x, y, 0, 0 );
+    opt.drawing_box = true;
+    opt.box = Rect( x, y, 0, 0 );
     break;
   case CV_EVENT_LBUTTONUP:
-    drawing_box = false;
-    if( box.width < 0 ){
-        box.x += box.width;
-        box.width *= -1;
+    opt.drawing_box = false;
+    if( opt.box.width < 0 ){
+        opt.box.x += opt.box.width;
+        opt.box.width *= -1;
     }
-    if( box.height < 0 ){
-        box.y += box.height;
-        box.height *= -1;
+    if( opt.box.height < 0 ){
+        opt.box.y += opt.box.height;
+        opt.box.height *= -1;
     }
-    gotBB = true;
+    opt.gotBB = true;
     break;
   }
 }
 
+//Output file: text (bounding_boxes.txt format) or binary records
+ResultSink* openSink(const Options& opt,const string& name){
+  if (opt.binout)
+    return new BinaryResultSink(name+".bin");
+  return new CsvResultSink(name+".txt");
+}
+
 void print_help(char** argv){
   printf("use:\n     %s -p /path/parameters.yml\n",argv[0]);
-  printf("-s    source video\n-b        bounding box file\n-tl  track and learn\n-r     repeat\n");
+  printf("-s    source video\n-b        bounding box file\n-tl  track and learn\n-r     repeat\n-bin  binary output files\n-ml   load model (-b optional)\n-ms   save model at the end\n-c    cache decoded frames next to the video\n-prof write a Chrome trace of the last 1000 frames\n");
 }
 
-void read_options(int argc, char** argv,VideoCapture& capture,FileStorage &fs){
+void read_options(int argc, char** argv,FileStorage &fs,Options& opt){
   for (int i=0;i<argc;i++){
       if (strcmp(argv[i],"-b")==0){
           if (argc>i){
-              readBB(argv[i+1]);
-              gotBB = true;
+              opt.box = readBB(argv[i+1]);
+              opt.gotBB = true;
           }
           else
             print_help(argv);
       }
       if (strcmp(argv[i],"-s")==0){
           if (argc>i){
-              video = string(argv[i+1]);
-              capture.open(video);
-              fromfile = true;
+              opt.video = string(argv[i+1]);
+              opt.fromfile = true;
           }
           else
             print_help(argv);
@@ -92,115 +110,152 @@ void read_options(int argc, char** argv,VideoCapture& capture,FileStorage &fs){
             print_help(argv);
       }
       if (strcmp(argv[i],"-tl")==0){
-          tl = true;
+          opt.tl = true;
       }
       if (strcmp(argv[i],"-r")==0){
-          rep = true;
+          opt.rep = true;
+      }
+      if (strcmp(argv[i],"-c")==0){
+          opt.cache = true;
+      }
+      if (strcmp(argv[i],"-bin")==0){
+          opt.binout = true;
+      }
+      if (strcmp(argv[i],"-ml")==0){
+          if (i+1<argc){
+              opt.model_in = string(argv[i+1]);
+              opt.gotBB = true;
+          }
+          else
+            print_help(argv);
+      }
+      if (strcmp(argv[i],"-prof")==0){
+          if (i+1<argc){
+              opt.trace = string(argv[i+1]);
+          }
+          else
+            print_help(argv);
+      }
+      if (strcmp(argv[i],"-ms")==0){
+          if (i+1<argc){
+              opt.model_out = string(argv[i+1]);
+          }
+          else
+            print_help(argv);
       }
   }
 }
 
 int main(int argc, char * argv[]){
-  VideoCapture capture;
-  capture.open(0);
+  FrameSource source;
   FileStorage fs;
+  Options opt;
   //Read options
-  read_options(argc,argv,capture,fs);
-  //Init camera
-  if (!capture.isOpened())
+  read_options(argc,argv,fs,opt);
+  //Init video file or camera
+  if (opt.fromfile)
+    source.open(opt.video,opt.cache ? opt.video+".frames" : "");
+  else
+    source.open(0);
+  if (!source.isOpened())
   {
 	cout << "capture device failed to open!" << endl;
     return 1;
   }
   //Register mouse callback to draw the bounding box
   cvNamedWindow("TLD",CV_WINDOW_AUTOSIZE);
-  cvSetMouseCallback( "TLD", mouseHandler, NULL );
-  //TLD framework
-  TLD tld;
-  //Read parameters file
-  tld.read(fs.getFirstTopLevelNode());
+  cvSetMouseCallback( "TLD", mouseHandler, &opt );
+  //TLD framework, parameters from file
+  TLDSession session(fs.getFirstTopLevelNode());
+  session.setShowExamples(true);
+  TLD_INFO("Kernels: %s (detected %s)",cpuIsaName(cpuIsa()),cpuIsaName(cpuIsaDetected()));
+  if (!opt.trace.empty())
+    session.profiler().setTrace(true,1000);
   Mat frame;
-  Mat last_gray;
+  Mat gray; //owned by the source, the session borrows it
   Mat first;
-  if (fromfile){
-      capture >> frame;
-      cvtColor(frame, last_gray, CV_RGB2GRAY);
+  if (opt.fromfile){
+      source.read(gray,&frame);
       frame.copyTo(first);
   }else{
-      capture.set(CV_CAP_PROP_FRAME_WIDTH,340);
-      capture.set(CV_CAP_PROP_FRAME_HEIGHT,240);
+      source.set(CV_CAP_PROP_FRAME_WIDTH,340);
+      source.set(CV_CAP_PROP_FRAME_HEIGHT,240);
   }
 
   ///Initialization
 GETBOUNDINGBOX:
-  while(!gotBB)
+  while(!opt.gotBB)
   {
-    if (!fromfile){
-      capture >> frame;
+    if (!opt.fromfile){
+      source.read(gray,&frame);
     }
     else
       first.copyTo(frame);
-    cvtColor(frame, last_gray, CV_RGB2GRAY);
-    drawBox(frame,box);
+    drawBox(frame,opt.box);
     imshow("TLD", frame);
     if (cvWaitKey(33) == 'q')
 	    return 0;
   }
-  if (min(box.width,box.height)<(int)fs.getFirstTopLevelNode()["min_win"]){
+  if (gray.empty())
+    source.read(gray,&frame);
+  bool resume = !opt.model_in.empty() && opt.box.area()==0;
+  if (!resume && min(opt.box.width,opt.box.height)<(int)fs.getFirstTopLevelNode()["min_win"]){
       cout << "Bounding box too small, try again." << endl;
-      gotBB = false;
+      opt.gotBB = false;
       goto GETBOUNDINGBOX;
   }
   //Remove callback
   cvSetMouseCallback( "TLD", NULL, NULL );
-  printf("Initial Bounding Box = x:%d y:%d h:%d w:%d\n",box.x,box.y,box.width,box.height);
+  TLD_INFO("Initial Bounding Box = x:%d y:%d h:%d w:%d",opt.box.x,opt.box.y,opt.box.width,opt.box.height);
   //Output file
-  FILE  *bb_file = fopen("bounding_boxes.txt","w");
+  ResultSink* sink = openSink(opt,"bounding_boxes");
+  session.setSink(sink);
+  session.setLearning(opt.tl);
   //TLD initialization
-  tld.init(last_gray,box,bb_file);
+  if (!opt.model_in.empty()){
+      if (!session.loadModel(opt.model_in,gray,opt.box,true)){
+          delete sink;
+          return 1;
+      }
+  }
+  else
+    session.init(gray,opt.box,true);
 
   ///Run-time
-  Mat current_gray;
-  BoundingBox pbox;
-  vector<Point2f> pts1;
-  vector<Point2f> pts2;
-  bool status=true;
   int frames = 1;
   int detections = 1;
 REPEAT:
-  while(capture.read(frame)){
-    //get frame
-    cvtColor(frame, current_gray, CV_RGB2GRAY);
+  while(source.read(gray,&frame)){
     //Process Frame
-    tld.processFrame(last_gray,current_gray,pts1,pts2,pbox,status,tl,bb_file);
+    const TLDResult& result = session.process(gray,true);
     //Draw Points
-    if (status){
-      drawPoints(frame,pts1);
-      drawPoints(frame,pts2,Scalar(0,255,0));
-      drawBox(frame,pbox);
+    if (result.found){
+      drawPoints(frame,result.points1);
+      drawPoints(frame,result.points2,Scalar(0,255,0));
+      drawBox(frame,result.box);
       detections++;
     }
     //Display
     imshow("TLD", frame);
-    //swap points and images
-    swap(last_gray,current_gray);
-    pts1.clear();
-    pts2.clear();
     frames++;
-    printf("Detection rate: %d/%d\n",detections,frames);
+    TLD_INFO("Detection rate: %d/%d",detections,frames);
     if (cvWaitKey(33) == 'q')
       break;
   }
-  if (rep){
-    rep = false;
-    tl = false;
-    fclose(bb_file);
-    bb_file = fopen("final_detector.txt","w");
-    //capture.set(CV_CAP_PROP_POS_AVI_RATIO,0);
-    capture.release();
-    capture.open(video);
+  if (opt.rep){
+    opt.rep = false;
+    session.setLearning(false);
+    delete sink;
+    sink = openSink(opt,"final_detector");
+    session.setSink(sink);
+    //replays from the frame cache if the first pass completed it
+    source.rewind();
     goto REPEAT;
   }
-  fclose(bb_file);
+  delete sink;
+  if (!opt.model_out.empty())
+    session.saveModel(opt.model_out);
+  if (!opt.trace.empty() && !session.profiler().writeTrace(opt.trace))
+    TLD_ERROR("Could not write trace %s",opt.trace.c_str());
   return 0;
 }
@@ -0,0 +1,317 @@
+/*
+ * tld_bench.cpp
+ *
+ * Replays the sequences in datasets/ and reports speed (fps, per-frame
+ * latency) next to accuracy (against gt.txt and the TLD1.0.txt results) as
+ * JSON, so a speedup and its accuracy cost are measured in one run.
+ */
+#include <opencv2/opencv.hpp>
+#include <TLDSession.h>
+#include <FrameSource.h>
+#include <JsonWriter.h>
+#include <tld_eval.h>
+#include <PerfCounters.h>
+#include <CpuFeatures.h>
+#include <tld_log.h>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+using namespace cv;
+using namespace std;
+
+struct BenchOptions {
+  BenchOptions():datasets("../datasets"),output("bench.json"),tl(false),cache(false),max_frames(0){}
+  string params;
+  string datasets;
+  string output;
+  string trace;              //trace file prefix, empty: no traces
+  string isa;                //kernel instruction set, empty: the detected one
+  vector<string> sequences;  //empty: every sequence with a video
+  bool tl;
+  bool cache;
+  int max_frames;            //0: whole sequence
+};
+
+struct SequenceRun {
+  string name;
+  string video;
+  string skipped;            //reason, empty if the sequence ran
+  int frames;
+  double init_ms;
+  double decode_ms;
+  double process_ms;
+  TLDTimings stages;         //sums over the processed frames
+  vector<double> latency;    //process() per frame, ms
+  int degraded[5];           //frames with each TLDDegradation flag
+  vector<EvalBox> boxes;
+  vector<EvalBox> gt;
+  vector<EvalBox> tld1;      //empty if the sequence has no TLD1.0.txt
+  Profiler profile;          //stage histograms and counters
+  int64_t hw[PERF_NUM_EVENTS];  //hardware events in process(), -1: unavailable
+};
+
+static double elapsedMs(int64 t0){
+  return (getTickCount()-t0)*1000.0/getTickFrequency();
+}
+
+void print_help(char** argv){
+  printf("use:\n     %s -p /path/parameters.yml\n",argv[0]);
+  printf("-d    datasets directory (default ../datasets)\n-seq  sequence to run (repeatable, default all)\n-o    JSON report (default bench.json)\n-tl   track and learn\n-c    cache decoded frames next to the videos\n-n    maximum frames per sequence\n-trace write <prefix><sequence>.json Chrome traces\n-isa  kernel instruction set (scalar, sse2, sse4.1, avx2, avx512)\n");
+}
+
+bool read_options(int argc,char** argv,BenchOptions& opt){
+  for (int i=1;i<argc;i++){
+      bool has_value = i+1<argc;
+      if (strcmp(argv[i],"-p")==0 && has_value)
+        opt.params = argv[++i];
+      else if (strcmp(argv[i],"-d")==0 && has_value)
+        opt.datasets = argv[++i];
+      else if (strcmp(argv[i],"-seq")==0 && has_value)
+        opt.sequences.push_back(argv[++i]);
+      else if (strcmp(argv[i],"-o")==0 && has_value)
+        opt.output = argv[++i];
+      else if (strcmp(argv[i],"-trace")==0 && has_value)
+        opt.trace = argv[++i];
+      else if (strcmp(argv[i],"-isa")==0 && has_value)
+        opt.isa = argv[++i];
+      else if (strcmp(argv[i],"-n")==0 && has_value)
+        opt.max_frames = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-tl")==0)
+        opt.tl = true;
+      else if (strcmp(argv[i],"-c")==0)
+        opt.cache = true;
+      else {
+          print_help(argv);
+          return false;
+      }
+  }
+  if (opt.params.empty()){
+      print_help(argv);
+      return false;
+  }
+  return true;
+}
+
+void runSequence(const FileNode& params,const BenchOptions& opt,const string& dir,SequenceRun& run){
+  run.frames = 0;
+  run.init_ms = run.decode_ms = run.process_ms = 0;
+  run.stages.track = run.stages.detect = run.stages.learn = run.stages.total = 0;
+  memset(run.degraded,0,sizeof(run.degraded));
+  fill(run.hw,run.hw+PERF_NUM_EVENTS,(int64_t)-1);
+  run.video = findVideo(dir);
+  vector<EvalBox> init;
+  if (run.video.empty()){
+      run.skipped = "no video";
+      return;
+  }
+  if (!readBoxes(dir+"/gt.txt",run.gt) || !readBoxes(dir+"/init.txt",init) || init.empty()){
+      run.skipped = "no gt.txt or init.txt";
+      return;
+  }
+  readBoxes(dir+"/TLD1.0.txt",run.tld1);
+  FrameSource source;
+  if (!source.open(run.video,opt.cache ? run.video+".frames" : "")){
+      run.skipped = "video failed to open";
+      return;
+  }
+  //Same conversion as run_tld's readBB
+  Rect box((int)init[0].x1,(int)init[0].y1,(int)init[0].x2-(int)init[0].x1,(int)init[0].y2-(int)init[0].y1);
+  TLDSession session(params);
+  session.setLearning(opt.tl);
+  if (!opt.trace.empty())
+    session.profiler().setTrace(true,opt.max_frames>0 ? opt.max_frames : 3000);
+  PerfCounters perf;
+  Mat gray;
+  int64 t0 = getTickCount();
+  if (!source.read(gray)){
+      run.skipped = "empty video";
+      return;
+  }
+  run.decode_ms += elapsedMs(t0);
+  t0 = getTickCount();
+  const TLDResult& first = session.init(gray,box,true);
+  run.init_ms = elapsedMs(t0);
+  run.boxes.push_back(toEvalBox(first.record()));
+  run.frames = 1;
+  while (opt.max_frames<=0 || run.frames<opt.max_frames){
+      t0 = getTickCount();
+      if (!source.read(gray))
+        break;
+      run.decode_ms += elapsedMs(t0);
+      t0 = getTickCount();
+      perf.start();
+      const TLDResult& result = session.process(gray,true);
+      perf.stop();
+      double ms = elapsedMs(t0);
+      run.latency.push_back(ms);
+      run.process_ms += ms;
+      run.stages.track += result.timings.track;
+      run.stages.detect += result.timings.detect;
+      run.stages.learn += result.timings.learn;
+      run.stages.total += result.timings.total;
+      for (int d=0;d<5;d++)
+        run.degraded[d] += (result.degraded>>d)&1;
+      run.boxes.push_back(toEvalBox(result.record()));
+      run.frames++;
+  }
+  if (!opt.trace.empty() && !session.profiler().writeTrace(opt.trace+run.name+".json"))
+    printf("Could not write trace %s%s.json\n",opt.trace.c_str(),run.name.c_str());
+  run.profile = session.profiler();
+  run.profile.setTrace(false);
+  for (int e=0;e<PERF_NUM_EVENTS;e++)
+    run.hw[e] = perf.total(e);
+}
+
+void writeScore(JsonWriter& json,const string& name,const EvalScore& s){
+  json.key(name).beginObject();
+  json.member("frames",s.frames);
+  json.member("detections",s.detections);
+  json.member("true_detections",s.true_detections);
+  json.member("correct_detections",s.correct_detections);
+  json.member("precision",s.precision);
+  json.member("recall",s.recall);
+  json.member("f_measure",s.f_measure);
+  json.endObject();
+}
+
+void writeLatency(JsonWriter& json,const LatencyStats& l){
+  json.key("latency_ms").beginObject();
+  json.member("mean",l.mean);
+  json.member("p50",l.p50);
+  json.member("p90",l.p90);
+  json.member("p99",l.p99);
+  json.member("max",l.max);
+  json.endObject();
+}
+
+//Appends the compared frames of one sequence, for the totals
+static void appendCompared(vector<EvalBox>& all_boxes,vector<EvalBox>& all_truth,const vector<EvalBox>& boxes,const vector<EvalBox>& truth){
+  size_t n = min(boxes.size(),truth.size());
+  all_boxes.insert(all_boxes.end(),boxes.begin(),boxes.begin()+n);
+  all_truth.insert(all_truth.end(),truth.begin(),truth.begin()+n);
+}
+
+int main(int argc,char* argv[]){
+  BenchOptions opt;
+  if (!read_options(argc,argv,opt))
+    return 1;
+  if (!opt.isa.empty() && !setCpuIsa(opt.isa.c_str())){
+      printf("Instruction set %s is not available, this CPU has %s\n",opt.isa.c_str(),cpuIsaName(cpuIsaDetected()));
+      return 1;
+  }
+  printf("Kernels: %s (detected %s)\n",cpuIsaName(cpuIsa()),cpuIsaName(cpuIsaDetected()));
+  FileStorage fs(opt.params,FileStorage::READ);
+  if (!fs.isOpened()){
+      printf("Could not read parameters %s\n",opt.params.c_str());
+      return 1;
+  }
+  vector<string> names = opt.sequences.empty() ? listDirectory(opt.datasets) : opt.sequences;
+  vector<SequenceRun> runs;
+  for (size_t i=0;i<names.size();i++){
+      string dir = opt.datasets+"/"+names[i];
+      if (!isDirectory(dir))
+        continue;
+      runs.push_back(SequenceRun());
+      SequenceRun& run = runs.back();
+      run.name = names[i];
+      runSequence(fs.getFirstTopLevelNode(),opt,dir,run);
+      if (!run.skipped.empty()){
+          printf("%-16s skipped (%s)\n",run.name.c_str(),run.skipped.c_str());
+          continue;
+      }
+      EvalScore s = evaluate(run.boxes,run.gt);
+      printf("%-16s %5d frames %7.1f fps  p50 %6.2f ms  precision %.3f recall %.3f\n",run.name.c_str(),run.frames,
+          run.process_ms>0 ? run.latency.size()*1000.0/run.process_ms : 0,latencyStats(run.latency).p50,s.precision,s.recall);
+  }
+  tld_log_flush();
+
+  FILE* file = fopen(opt.output.c_str(),"w");
+  if (!file){
+      printf("Could not write %s\n",opt.output.c_str());
+      return 1;
+  }
+  JsonWriter json(file);
+  json.beginObject();
+  json.member("params",opt.params);
+  json.member("learning",opt.tl);
+  json.member("cache",opt.cache);
+  json.member("max_frames",opt.max_frames);
+  json.member("min_overlap",0.25);
+  json.member("isa",cpuIsaName(cpuIsa()));
+  json.member("isa_detected",cpuIsaName(cpuIsaDetected()));
+  json.key("sequences").beginArray();
+  vector<double> all_latency;
+  vector<EvalBox> all_boxes, all_gt, tld1_boxes, tld1_gt, base_boxes, base_gt;
+  int all_frames = 0;
+  double all_process_ms = 0;
+  for (size_t i=0;i<runs.size();i++){
+      const SequenceRun& run = runs[i];
+      json.beginObject();
+      json.member("name",run.name);
+      if (!run.skipped.empty()){
+          json.member("skipped",run.skipped);
+          json.endObject();
+          continue;
+      }
+      int processed = run.latency.size();
+      json.member("video",run.video);
+      json.member("frames",run.frames);
+      json.member("init_ms",run.init_ms);
+      json.member("decode_ms_per_frame",run.decode_ms/run.frames);
+      json.member("fps",run.process_ms>0 ? processed*1000.0/run.process_ms : 0.0);
+      writeLatency(json,latencyStats(run.latency));
+      json.key("stages_ms").beginObject();
+      json.member("track",processed>0 ? run.stages.track/processed : 0.0);
+      json.member("detect",processed>0 ? run.stages.detect/processed : 0.0);
+      json.member("learn",processed>0 ? run.stages.learn/processed : 0.0);
+      json.endObject();
+      //Frames shed to stay within frame_budget_ms
+      json.key("degraded_frames").beginObject();
+      json.member("defer_learning",run.degraded[0]);
+      json.member("local_detection",run.degraded[1]);
+      json.member("partial_nn",run.degraded[2]);
+      json.member("track_only",run.degraded[3]);
+      json.member("init_pending",run.degraded[4]);
+      json.endObject();
+      //Hardware events per processed frame, detector thread excluded (see PerfCounters.h)
+      json.key("hw_counters").beginObject();
+      for (int e=0;e<PERF_NUM_EVENTS;e++)
+        json.member(perfEventName(e),run.hw[e]>=0 && processed>0 ? run.hw[e]/(double)processed : -1.0);
+      json.endObject();
+      json.key("accuracy").beginObject();
+      writeScore(json,"gt",evaluate(run.boxes,run.gt));
+      if (!run.tld1.empty())
+        writeScore(json,"tld1",evaluate(run.boxes,run.tld1));
+      json.endObject();
+      //The bundled TLD1.0 result scored the same way, for reference
+      if (!run.tld1.empty())
+        writeScore(json,"baseline_tld1",evaluate(run.tld1,run.gt));
+      json.key("profile");
+      run.profile.writeJson(json);
+      json.endObject();
+      all_latency.insert(all_latency.end(),run.latency.begin(),run.latency.end());
+      all_frames += run.frames;
+      all_process_ms += run.process_ms;
+      appendCompared(all_boxes,all_gt,run.boxes,run.gt);
+      if (!run.tld1.empty()){
+          appendCompared(tld1_boxes,tld1_gt,run.boxes,run.tld1);
+          appendCompared(base_boxes,base_gt,run.tld1,run.gt);
+      }
+  }
+  json.endArray();
+  //Totals over every frame of the sequences that ran
+  json.key("total").beginObject();
+  json.member("frames",all_frames);
+  json.member("fps",all_process_ms>0 ? all_latency.size()*1000.0/all_process_ms : 0.0);
+  writeLatency(json,latencyStats(all_latency));
+  json.key("accuracy").beginObject();
+  writeScore(json,"gt",evaluate(all_boxes,all_gt));
+  writeScore(json,"tld1",evaluate(tld1_boxes,tld1_gt));
+  json.endObject();
+  writeScore(json,"baseline_tld1",evaluate(base_boxes,base_gt));
+  json.endObject();
+  json.endObject();
+  fclose(file);
+  printf("Report written to %s\n",opt.output.c_str());
+  return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ * tld_check.cpp
+ *
+ * Replays the datasets/ sequences with the parameters as given (fast paths
+ * included) and checks them against the reference implementations: every
+ * stage of every frame is recomputed by an EquivalenceChecker, and a second
+ * session with the fast paths turned off runs alongside to compare the
+ * output boxes. Exits with 2 when anything diverged, so a kernel rewrite can
+ * be gated on it. Use parameters without frame_budget_ms and async_init,
+ * shedding work and the frames tracked before training ends depend on
+ * timing and differ between runs.
+ */
+#include <opencv2/opencv.hpp>
+#include <TLDSession.h>
+#include <FrameSource.h>
+#include <EquivalenceChecker.h>
+#include <JsonWriter.h>
+#include <tld_eval.h>
+#include <tld_log.h>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+using namespace cv;
+using namespace std;
+
+struct CheckOptions {
+  CheckOptions():datasets("../datasets"),output("check.json"),tl(false),cache(false),max_frames(0),grid_configs(0){}
+  string params;
+  string datasets;
+  string output;
+  vector<string> sequences;  //empty: every sequence with a video
+  bool tl;
+  bool cache;
+  int max_frames;            //0: whole sequence
+  int grid_configs;          //-grid: random WindowGrid configurations checked instead of the sequences
+};
+
+//Output boxes of the checked session against the reference session
+struct OutputDivergence {
+  int frames;
+  int found;                 //frames where only one session found the object
+  int boxes;                 //frames where both found it with different boxes
+  int max_delta;             //largest coordinate difference, pixels
+  double sum_delta;
+  double min_overlap;
+  int first_frame;           //-1: identical outputs
+};
+
+struct CheckRun {
+  string name;
+  string skipped;            //reason, empty if the sequence ran
+  EquivalenceChecker stages;
+  OutputDivergence output;
+};
+
+void print_help(char** argv){
+  printf("use:\n     %s -p /path/parameters.yml\n",argv[0]);
+  printf("-d    datasets directory (default ../datasets)\n-seq  sequence to run (repeatable, default all)\n-o    JSON report (default check.json)\n-tl   track and learn\n-c    cache decoded frames next to the videos\n-n    maximum frames per sequence\n-grid check the window grid queries on n random configurations\n");
+}
+
+bool read_options(int argc,char** argv,CheckOptions& opt){
+  for (int i=1;i<argc;i++){
+      bool has_value = i+1<argc;
+      if (strcmp(argv[i],"-p")==0 && has_value)
+        opt.params = argv[++i];
+      else if (strcmp(argv[i],"-d")==0 && has_value)
+        opt.datasets = argv[++i];
+      else if (strcmp(argv[i],"-seq")==0 && has_value)
+        opt.sequences.push_back(argv[++i]);
+      else if (strcmp(argv[i],"-o")==0 && has_value)
+        opt.output = argv[++i];
+      else if (strcmp(argv[i],"-n")==0 && has_value)
+        opt.max_frames = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-grid")==0 && has_value)
+        opt.grid_configs = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-tl")==0)
+        opt.tl = true;
+      else if (strcmp(argv[i],"-c")==0)
+        opt.cache = true;
+      else {
+          print_help(argv);
+          return false;
+      }
+  }
+  if (opt.params.empty() && opt.grid_configs<=0){
+      print_help(argv);
+      return false;
+  }
+  return true;
+}
+
+//WindowGrid's window decoding against the materialized grid it replaced,
+//and its overlap queries against a scan of every window, on random frames,
+//boxes (partly outside the frame), grid parameters and thresholds
+static bool checkGrid(int configs){
+  RNG rng(0x2545F491u);
+  int differ[4] = {0,0,0,0};
+  vector<int> idx, ref_idx, ref_far;
+  vector<float> overlap, ref_overlap;
+  for (int n=0;n<configs;n++){
+      Size frame(rng.uniform(40,641),rng.uniform(40,481));
+      int min_win = rng.uniform(8,25);
+      int w = rng.uniform(min_win,frame.width+1);
+      int h = rng.uniform(min_win,frame.height+1);
+      Rect box(rng.uniform(-w/4,frame.width-w+w/4+1),rng.uniform(-h/4,frame.height-h+h/4+1),w,h);
+      //0 keeps the default shift, scale step and number of scales
+      float shift = rng.uniform(0,3)==0 ? 0 : rng.uniform(0.05f,0.3f);
+      float scale_step = rng.uniform(0,3)==0 ? 0 : rng.uniform(1.1f,1.5f);
+      int num_scales = rng.uniform(0,3)==0 ? 0 : rng.uniform(1,22);
+      float th = rng.uniform(0.05f,0.95f);
+      WindowGrid grid;
+      grid.build(frame,box,min_win,shift,scale_step,num_scales);
+      //Per scale, rows then columns from (1,1), as the grid was once stored
+      int i = 0;
+      bool layout = true;
+      for (int s=0;s<grid.numScales();s++){
+          Size size = grid.scale(s).size;
+          int step = max(1,(int)round((shift>0 ? shift : 0.1f)*min(size.width,size.height)));
+          for (int y=1;y<frame.height-size.height;y+=step){
+              for (int x=1;x<frame.width-size.width;x+=step,i++){
+                  BoundingBox bb = i<grid.size() ? grid.window(i) : BoundingBox();
+                  layout = layout && i<grid.size() && bb.x==x && bb.y==y && bb.size()==size && bb.sidx==s;
+              }
+          }
+      }
+      differ[3] += !layout || i!=grid.size();
+      ref_idx.clear();
+      ref_overlap.clear();
+      ref_far.clear();
+      int ref_best = -1;
+      float ref_max = 0;
+      for (int i=0;i<grid.size();i++){
+          float o = bbOverlap(grid.window(i),box);
+          if (o>th){
+              ref_idx.push_back(i);
+              ref_overlap.push_back(o);
+          }
+          if (o<th)
+            ref_far.push_back(i);
+          if (o>ref_max){
+              ref_max = o;
+              ref_best = i;
+          }
+      }
+      grid.overlapping(box,th,idx,overlap);
+      differ[0] += idx!=ref_idx || overlap!=ref_overlap;
+      grid.farFrom(box,th,idx);
+      differ[1] += idx!=ref_far;
+      float best_overlap;
+      int best = grid.closest(box,best_overlap);
+      differ[2] += best!=ref_best || best_overlap!=ref_max;
+  }
+  printf("%d grid configurations, differing: windows %d, overlapping %d, farFrom %d, closest %d\n",configs,differ[3],differ[0],differ[1],differ[2]);
+  return differ[0]+differ[1]+differ[2]+differ[3]==0;
+}
+
+static void compareOutputs(const TLDResult& fast,const TLDResult& ref,OutputDivergence& out){
+  out.frames++;
+  if (fast.found!=ref.found){
+      out.found++;
+      if (out.first_frame<0)
+        out.first_frame = fast.frame;
+      return;
+  }
+  if (!fast.found)
+    return;
+  const Rect& a = fast.box;
+  const Rect& b = ref.box;
+  int delta = max(max(abs(a.x-b.x),abs(a.y-b.y)),max(abs(a.width-b.width),abs(a.height-b.height)));
+  if (delta>0){
+      out.boxes++;
+      if (out.first_frame<0)
+        out.first_frame = fast.frame;
+  }
+  out.max_delta = max(out.max_delta,delta);
+  out.sum_delta += delta;
+  out.min_overlap = min(out.min_overlap,(double)bbOverlap(a,b));
+}
+
+//Both sessions draw the same random numbers (fern features, warps, negative shuffles)
+static void seedFrame(int frame){
+  theRNG().state = 0x2545F491u+frame;
+  srand(frame+1);
+}
+
+void runSequence(const FileNode& params,const CheckOptions& opt,const string& dir,CheckRun& run){
+  memset(&run.output,0,sizeof(run.output));
+  run.output.min_overlap = 1;
+  run.output.first_frame = -1;
+  string video = findVideo(dir);
+  vector<EvalBox> init;
+  if (video.empty() || !readBoxes(dir+"/init.txt",init) || init.empty()){
+      run.skipped = "no video or init.txt";
+      return;
+  }
+  FrameSource source;
+  Mat gray;
+  if (!source.open(video,opt.cache ? video+".frames" : "") || !source.read(gray)){
+      run.skipped = "video failed to open";
+      return;
+  }
+  //Same conversion as run_tld's readBB
+  Rect box((int)init[0].x1,(int)init[0].y1,(int)init[0].x2-(int)init[0].x1,(int)init[0].y2-(int)init[0].y1);
+  TLDSession session(params);
+  TLDSession reference(params);
+  session.setLearning(opt.tl);
+  reference.setLearning(opt.tl);
+  reference.setReferencePaths();
+  session.setChecker(&run.stages);
+  seedFrame(0);
+  session.init(gray,box,true);
+  seedFrame(0);
+  reference.init(gray,box,true);
+  int frames = 1;
+  while (opt.max_frames<=0 || frames<opt.max_frames){
+      if (!source.read(gray))
+        break;
+      run.stages.setFrame(frames);
+      seedFrame(frames);
+      const TLDResult& fast = session.process(gray,true);
+      seedFrame(frames);
+      const TLDResult& ref = reference.process(gray,true);
+      compareOutputs(fast,ref,run.output);
+      frames++;
+  }
+}
+
+static void writeOutput(JsonWriter& json,const OutputDivergence& o){
+  json.key("output").beginObject();
+  json.member("frames",o.frames);
+  json.member("found",o.found);
+  json.member("boxes",o.boxes);
+  json.member("max_delta",o.max_delta);
+  json.member("mean_delta",o.frames>0 ? o.sum_delta/o.frames : 0.0);
+  json.member("min_overlap",o.min_overlap);
+  json.member("first_frame",o.first_frame);
+  json.endObject();
+}
+
+int main(int argc,char* argv[]){
+  CheckOptions opt;
+  if (!read_options(argc,argv,opt))
+    return 1;
+  if (opt.grid_configs>0){
+      bool same = checkGrid(opt.grid_configs);
+      printf("%s\n",same ? "equivalent" : "DIVERGED");
+      return same ? 0 : 2;
+  }
+  FileStorage fs(opt.params,FileStorage::READ);
+  if (!fs.isOpened()){
+      printf("Could not read parameters %s\n",opt.params.c_str());
+      return 1;
+  }
+  vector<string> names = opt.sequences.empty() ? listDirectory(opt.datasets) : opt.sequences;
+  vector<CheckRun*> runs;
+  EquivalenceChecker total;
+  OutputDivergence total_output;
+  memset(&total_output,0,sizeof(total_output));
+  total_output.min_overlap = 1;
+  total_output.first_frame = -1;
+  bool diverged = false;
+  printf("%-16s %6s %12s %12s %12s %12s %12s\n","sequence","frames","variance","ferns","nn","track","boxes");
+  for (size_t i=0;i<names.size();i++){
+      string dir = opt.datasets+"/"+names[i];
+      if (!isDirectory(dir))
+        continue;
+      CheckRun* run = new CheckRun();
+      run->name = names[i];
+      runs.push_back(run);
+      runSequence(fs.getFirstTopLevelNode(),opt,dir,*run);
+      if (!run->skipped.empty()){
+          printf("%-16s skipped (%s)\n",run->name.c_str(),run->skipped.c_str());
+          continue;
+      }
+      //Differing decisions per stage, and frames with differing output
+      const OutputDivergence& o = run->output;
+      printf("%-16s %6d",run->name.c_str(),o.frames+1);
+      for (int s=0;s<CHECK_NUM_STAGES;s++)
+        printf(" %12lld",(long long)run->stages.stage(s).decisions);
+      printf(" %12d\n",o.found+o.boxes);
+      total.merge(run->stages);
+      total_output.frames += o.frames;
+      total_output.found += o.found;
+      total_output.boxes += o.boxes;
+      total_output.max_delta = max(total_output.max_delta,o.max_delta);
+      total_output.sum_delta += o.sum_delta;
+      total_output.min_overlap = min(total_output.min_overlap,o.min_overlap);
+      diverged = diverged || run->stages.diverged() || o.found+o.boxes>0;
+  }
+  tld_log_flush();
+  FILE* file = fopen(opt.output.c_str(),"w");
+  if (!file){
+      printf("Could not write %s\n",opt.output.c_str());
+      return 1;
+  }
+  JsonWriter json(file);
+  json.beginObject();
+  json.member("params",opt.params);
+  json.member("learning",opt.tl);
+  json.member("max_frames",opt.max_frames);
+  json.key("sequences").beginArray();
+  for (size_t i=0;i<runs.size();i++){
+      const CheckRun& run = *runs[i];
+      json.beginObject();
+      json.member("name",run.name);
+      if (!run.skipped.empty())
+        json.member("skipped",run.skipped);
+      else {
+          json.key("stages");
+          run.stages.writeJson(json);
+          writeOutput(json,run.output);
+      }
+      json.endObject();
+      delete runs[i];
+  }
+  json.endArray();
+  json.key("total").beginObject();
+  json.key("stages");
+  total.writeJson(json);
+  writeOutput(json,total_output);
+  json.member("diverged",diverged);
+  json.endObject();
+  json.endObject();
+  fclose(file);
+  printf("%s, report written to %s\n",diverged ? "DIVERGED" : "equivalent",opt.output.c_str());
+  return diverged ? 2 : 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * tld_eval.cpp
+ */
+
+#include <tld_eval.h>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <math.h>
+using namespace std;
+
+bool readBoxes(const string& path,vector<EvalBox>& boxes){
+  ifstream file(path.c_str());
+  if (!file.is_open())
+    return false;
+  boxes.clear();
+  string line;
+  while (getline(file,line)){
+      if (line.empty())
+        continue;
+      istringstream linestream(line);
+      string x1,y1,x2,y2;
+      getline(linestream,x1,',');
+      getline(linestream,y1,',');
+      getline(linestream,x2,',');
+      getline(linestream,y2,',');
+      EvalBox bb;
+      bb.valid = x1.compare(0,3,"NaN")!=0;
+      bb.x1 = atof(x1.c_str());
+      bb.y1 = atof(y1.c_str());
+      bb.x2 = atof(x2.c_str());
+      bb.y2 = atof(y2.c_str());
+      boxes.push_back(bb);
+  }
+  return true;
+}
+
+EvalBox toEvalBox(const ResultRecord& r){
+  EvalBox bb;
+  bb.valid = r.found;
+  bb.x1 = r.x1;
+  bb.y1 = r.y1;
+  bb.x2 = r.x2;
+  bb.y2 = r.y2;
+  return bb;
+}
+
+double evalOverlap(const EvalBox& bb1,const EvalBox& bb2){
+  if (!bb1.valid || !bb2.valid)
+    return 0;
+  if (bb1.x1>bb2.x2 || bb1.y1>bb2.y2 || bb1.x2<bb2.x1 || bb1.y2<bb2.y1)
+    return 0;
+  double colInt = min(bb1.x2,bb2.x2)-max(bb1.x1,bb2.x1);
+  double rowInt = min(bb1.y2,bb2.y2)-max(bb1.y1,bb2.y1);
+  double intersection = colInt*rowInt;
+  double area1 = ((double)bb1.x2-bb1.x1)*((double)bb1.y2-bb1.y1);
+  double area2 = ((double)bb2.x2-bb2.x1)*((double)bb2.y2-bb2.y1);
+  return intersection/(area1+area2-intersection);
+}
+
+EvalScore evaluate(const vector<EvalBox>& boxes,const vector<EvalBox>& truth,double min_overlap){
+  EvalScore s;
+  s.frames = min(boxes.size(),truth.size());
+  s.detections = 0;
+  s.true_detections = 0;
+  s.correct_detections = 0;
+  for (int i=0;i<s.frames;i++){
+      if (boxes[i].valid)
+        s.detections++;
+      if (truth[i].valid)
+        s.true_detections++;
+      if (evalOverlap(boxes[i],truth[i])>min_overlap)
+        s.correct_detections++;
+  }
+  s.precision = s.detections>0 ? (double)s.correct_detections/s.detections : 0;
+  s.recall = s.true_detections>0 ? (double)s.correct_detections/s.true_detections : 0;
+  s.f_measure = (s.precision>0 || s.recall>0) ? 2*s.precision*s.recall/(s.precision+s.recall) : 0;
+  return s;
+}
+
+//Nearest rank percentile of sorted samples
+static double percentile(const vector<double>& sorted,double p){
+  int rank = (int)ceil(p*sorted.size())-1;
+  return sorted[max(0,min(rank,(int)sorted.size()-1))];
+}
+
+LatencyStats latencyStats(vector<double> samples){
+  LatencyStats l;
+  l.count = samples.size();
+  l.mean = l.p50 = l.p90 = l.p99 = l.max = 0;
+  if (samples.empty())
+    return l;
+  sort(samples.begin(),samples.end());
+  double sum = 0;
+  for (size_t i=0;i<samples.size();i++)
+    sum += samples[i];
+  l.mean = sum/samples.size();
+  l.p50 = percentile(samples,0.5);
+  l.p90 = percentile(samples,0.9);
+  l.p99 = percentile(samples,0.99);
+  l.max = samples.back();
+  return l;
+}
+
+bool isDirectory(const string& path){
+  struct stat st;
+  return stat(path.c_str(),&st)==0 && S_ISDIR(st.st_mode);
+}
+
+vector<string> listDirectory(const string& path){
+  vector<string> names;
+  DIR* dir = opendir(path.c_str());
+  if (!dir)
+    return names;
+  struct dirent* entry;
+  while ((entry = readdir(dir))!=NULL){
+      if (entry->d_name[0]!='.')
+        names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  sort(names.begin(),names.end());
+  return names;
+}
+
+//Like evaluate_all_visual.sh
+string findVideo(const string& dir){
+  vector<string> names = listDirectory(dir);
+  for (size_t i=0;i<names.size();i++){
+      const string& n = names[i];
+      if (n.size()>4 && n.compare(n.size()-4,4,".mpg")==0)
+        return dir+"/"+n;
+  }
+  return "";
+}
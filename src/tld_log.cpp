@@ -0,0 +1,188 @@
+/*
+ * tld_log.cpp
+ *
+ * Bounded multi-producer ring (one sequence number per slot, producers claim
+ * slots with a CAS) drained by a single background thread.
+ */
+
+#include <tld_log.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+using namespace std;
+
+namespace {
+
+const size_t RING_SIZE = 4096; //must be a power of two
+const int MSG_SIZE = 232;
+const char* LEVEL_NAMES[] = {"DEBUG","INFO","WARN","ERROR"};
+
+struct LogRecord {
+  atomic<size_t> seq;
+  int level;
+  unsigned tid;
+  double time;
+  char msg[MSG_SIZE];
+};
+
+atomic<int> log_level(-1);
+atomic<bool> log_structured(false);
+atomic<unsigned> next_tid(0);
+const chrono::steady_clock::time_point log_start = chrono::steady_clock::now();
+
+unsigned threadId(){
+  static thread_local unsigned tid = next_tid++;
+  return tid;
+}
+
+int levelFromEnv(){
+  const char* env = getenv("TLD_LOG_LEVEL");
+  if (!env)
+    return TLD_LOG_INFO;
+  if (strcmp(env,"debug")==0) return TLD_LOG_DEBUG;
+  if (strcmp(env,"warn")==0) return TLD_LOG_WARN;
+  if (strcmp(env,"error")==0) return TLD_LOG_ERROR;
+  if (strcmp(env,"none")==0) return TLD_LOG_NONE;
+  return TLD_LOG_INFO;
+}
+
+class LogRing {
+public:
+  LogRing();
+  ~LogRing();
+  void push(int level, const char* fmt, va_list args);
+  void flush();
+private:
+  bool drainOne();
+  void run();
+  LogRecord* ring;
+  atomic<size_t> head;     //next slot to claim (producers)
+  size_t tail;             //next slot to write (drainer only)
+  atomic<size_t> written;  //records written so far
+  atomic<size_t> dropped;
+  atomic<bool> running;
+  thread drainer;
+};
+
+LogRing::LogRing() : head(0), tail(0), written(0), dropped(0), running(true){
+  ring = new LogRecord[RING_SIZE];
+  for (size_t i=0;i<RING_SIZE;i++)
+    ring[i].seq.store(i,memory_order_relaxed);
+  drainer = thread(&LogRing::run,this);
+}
+
+LogRing::~LogRing(){
+  running = false;
+  drainer.join();
+  delete[] ring;
+}
+
+void LogRing::push(int level, const char* fmt, va_list args){
+  size_t pos = head.load(memory_order_relaxed);
+  LogRecord* r;
+  for (;;){
+      r = &ring[pos & (RING_SIZE-1)];
+      size_t seq = r->seq.load(memory_order_acquire);
+      if (seq == pos){
+          if (head.compare_exchange_weak(pos,pos+1,memory_order_relaxed))
+            break;
+      }
+      else if (seq < pos){ //full, never block the caller
+          dropped.fetch_add(1,memory_order_relaxed);
+          return;
+      }
+      else
+        pos = head.load(memory_order_relaxed);
+  }
+  r->level = level;
+  r->tid = threadId();
+  r->time = chrono::duration<double>(chrono::steady_clock::now()-log_start).count();
+  vsnprintf(r->msg,MSG_SIZE,fmt,args);
+  r->seq.store(pos+1,memory_order_release);
+}
+
+bool LogRing::drainOne(){
+  LogRecord& r = ring[tail & (RING_SIZE-1)];
+  if (r.seq.load(memory_order_acquire) != tail+1)
+    return false;
+  if (log_structured)
+    fprintf(stdout,"%.6f %s [%u] %s\n",r.time,LEVEL_NAMES[r.level],r.tid,r.msg);
+  else
+    fprintf(stdout,"%s\n",r.msg);
+  r.seq.store(tail+RING_SIZE,memory_order_release);
+  tail++;
+  written.fetch_add(1,memory_order_release);
+  return true;
+}
+
+void LogRing::run(){
+  size_t reported = 0;
+  for (;;){
+      bool any = false;
+      while (drainOne())
+        any = true;
+      size_t d = dropped.load(memory_order_relaxed);
+      if (d != reported){
+          fprintf(stdout,"[tld_log] %lu messages dropped\n",(unsigned long)(d-reported));
+          reported = d;
+          any = true;
+      }
+      if (any)
+        fflush(stdout);
+      else if (!running)
+        break;
+      else
+        this_thread::sleep_for(chrono::milliseconds(2));
+  }
+}
+
+void LogRing::flush(){
+  size_t target = head.load(memory_order_acquire);
+  //slots claimed but dropped are not counted in head, so written catches up
+  while (written.load(memory_order_acquire) < target)
+    this_thread::sleep_for(chrono::milliseconds(1));
+  fflush(stdout);
+}
+
+LogRing& logRing(){
+  static LogRing ring;
+  return ring;
+}
+
+}
+
+void tld_log_set_level(int level){
+  log_level = level;
+}
+
+int tld_log_get_level(){
+  int level = log_level.load(memory_order_relaxed);
+  if (level < 0){
+      level = levelFromEnv();
+      log_level = level;
+  }
+  return level;
+}
+
+bool tld_log_enabled(int level){
+  return level >= tld_log_get_level();
+}
+
+void tld_log_set_structured(bool structured){
+  log_structured = structured;
+}
+
+void tld_log_write(int level, const char* fmt, ...){
+  va_list args;
+  va_start(args,fmt);
+  logRing().push(level,fmt,args);
+  va_end(args);
+}
+
+void tld_log_flush(){
+  logRing().flush();
+}
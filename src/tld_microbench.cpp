@@ -0,0 +1,500 @@
+/*
+ * tld_microbench.cpp
+ *
+ * Timings of the core kernels on synthetic and dataset frames at several
+ * resolutions. Every kernel is run for a number of samples (each sample
+ * long enough to time reliably), the report gives the median and the
+ * median absolute deviation per operation. -compare puts two reports side
+ * by side, so one kernel optimization can be checked at a time.
+ */
+#include <opencv2/opencv.hpp>
+#include <TLD.h>
+#include <JsonWriter.h>
+#include <CpuFeatures.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+using namespace cv;
+using namespace std;
+
+struct MicroOptions {
+  MicroOptions():output("microbench.json"),samples(21),min_sample_ms(2),cpu(-1){}
+  string params;
+  string video;          //dataset frames, optional
+  string box_file;
+  string output;
+  string filter;         //only kernels whose name contains this
+  string compare[2];
+  string isa;            //kernel instruction set, empty: the detected one
+  int samples;
+  double min_sample_ms;
+  int cpu;               //pin to this core, -1: no pinning
+};
+
+struct KernelStats {
+  string name;
+  string config;
+  int ops;               //operations per call
+  int calls;             //calls per sample
+  double median;         //ns per operation
+  double mad;
+  double min;
+};
+
+//Keeps results alive so the compiler can't drop the kernels
+static volatile double sink;
+
+static double nowNs(){
+  return getTickCount()*1e9/getTickFrequency();
+}
+
+static double medianOf(vector<double> v){
+  sort(v.begin(),v.end());
+  size_t n = v.size();
+  return n%2 ? v[n/2] : 0.5*(v[n/2-1]+v[n/2]);
+}
+
+//Runs f (ops operations per call) and collects per-operation samples
+template <class F>
+KernelStats measure(const MicroOptions& opt,const string& name,const string& config,int ops,F f){
+  KernelStats k;
+  k.name = name;
+  k.config = config;
+  k.ops = ops;
+  //Warm up and calibrate the number of calls per sample
+  int calls = 1;
+  for (;;){
+      double t0 = nowNs();
+      for (int i=0;i<calls;i++)
+        f();
+      double ms = (nowNs()-t0)*1e-6;
+      if (ms>=opt.min_sample_ms || calls>=(1<<20))
+        break;
+      calls *= ms>0 ? max(2,min(16,(int)(opt.min_sample_ms/ms)+1)) : 16;
+  }
+  k.calls = calls;
+  vector<double> per_op(opt.samples);
+  for (int s=0;s<opt.samples;s++){
+      double t0 = nowNs();
+      for (int i=0;i<calls;i++)
+        f();
+      per_op[s] = (nowNs()-t0)/((double)calls*ops);
+  }
+  k.median = medianOf(per_op);
+  vector<double> dev(per_op.size());
+  for (size_t i=0;i<per_op.size();i++)
+    dev[i] = fabs(per_op[i]-k.median);
+  k.mad = medianOf(dev);
+  k.min = *min_element(per_op.begin(),per_op.end());
+  printf("%-14s %-24s %12.1f ns/op  +-%6.1f  (min %.1f)\n",name.c_str(),config.c_str(),k.median,k.mad,k.min);
+  return k;
+}
+
+//Textured frame with a brighter textured object in box
+static Mat syntheticFrame(Size size,const Rect& box,uint64 seed){
+  theRNG().state = seed;
+  Mat frame(size,CV_8U);
+  randu(frame,Scalar(0),Scalar(256));
+  GaussianBlur(frame,frame,Size(7,7),2);
+  Mat object(box.size(),CV_8U);
+  randu(object,Scalar(64),Scalar(256));
+  GaussianBlur(object,object,Size(3,3),1);
+  Mat roi = frame(box);
+  object.copyTo(roi);
+  return frame;
+}
+
+//Box-sized windows over the frame (same shift as the TLD grid)
+static vector<BoundingBox> slidingWindows(Size frame,Size box){
+  vector<BoundingBox> windows;
+  int step = max(1,(int)round(0.1*min(box.width,box.height)));
+  for (int y=1;y<frame.height-box.height;y+=step){
+      for (int x=1;x<frame.width-box.width;x+=step){
+          BoundingBox bb(Rect(x,y,box.width,box.height));
+          bb.sidx = 0;
+          windows.push_back(bb);
+      }
+  }
+  return windows;
+}
+
+static Rect scaleRect(const Rect& r,double sx,double sy){
+  return Rect(cvRound(r.x*sx),cvRound(r.y*sy),cvRound(r.width*sx),cvRound(r.height*sy));
+}
+
+static bool wanted(const MicroOptions& opt,const string& name){
+  return opt.filter.empty() || name.find(opt.filter)!=string::npos;
+}
+
+//Kernels that depend on the frame: grid, variance, patterns, ferns, clustering, tracking
+void runFrameKernels(const MicroOptions& opt,const FileNode& params,const string& config,
+    const Mat& frame,const Mat& next,const Rect& box,vector<KernelStats>& out){
+  TLD tld(params);
+  vector<BoundingBox> windows = slidingWindows(frame.size(),box.size());
+  if (windows.empty())
+    return;
+  BoundingBox target(box);
+  if (wanted(opt,"buildGrid"))
+    out.push_back(measure(opt,"buildGrid",config,1,[&](){tld.buildGrid(frame,box);}));
+  Mat iisum, iisqsum;
+  integral(frame,iisum,iisqsum);
+  if (wanted(opt,"getVar"))
+    out.push_back(measure(opt,"getVar",config,windows.size(),[&](){
+      double v = 0;
+      for (size_t i=0;i<windows.size();i++)
+        v += tld.getVar(windows[i],iisum,iisqsum);
+      sink = v;
+    }));
+  if (wanted(opt,"bbOverlap"))
+    out.push_back(measure(opt,"bbOverlap",config,windows.size(),[&](){
+      float o = 0;
+      for (size_t i=0;i<windows.size();i++)
+        o += tld.bbOverlap(windows[i],target);
+      sink = o;
+    }));
+  int npatches = min((int)windows.size(),256);
+  if (wanted(opt,"getPattern")){
+      Mat pattern;
+      Scalar mean, stdev;
+      out.push_back(measure(opt,"getPattern",config,npatches,[&](){
+        for (int i=0;i<npatches;i++)
+          tld.getPattern(frame(windows[i*windows.size()/npatches]),pattern,mean,stdev);
+        sink = mean.val[0];
+      }));
+  }
+  //Fern kernels on the blurred frame, one scale of the box size
+  FerNNClassifier classifier;
+  classifier.read(params);
+  classifier.prepare(vector<Size>(1,box.size()));
+  Mat img;
+  GaussianBlur(frame,img,Size(9,9),1.5);
+  int nwin = min((int)windows.size(),2000);
+  vector<vector<int> > ferns(nwin,vector<int>(classifier.getNumStructs()));
+  for (int i=0;i<nwin;i++)
+    classifier.getFeatures(img(windows[i]),0,ferns[i]);
+  if (wanted(opt,"getFeatures")){
+      vector<int> fern(classifier.getNumStructs());
+      out.push_back(measure(opt,"getFeatures",config,nwin,[&](){
+        for (int i=0;i<nwin;i++)
+          classifier.getFeatures(img(windows[i]),0,fern);
+        sink = fern[0];
+      }));
+  }
+  if (wanted(opt,"update"))
+    out.push_back(measure(opt,"update",config,nwin,[&](){
+      for (int i=0;i<nwin;i++)
+        classifier.update(ferns[i],i&1,1);
+    }));
+  if (wanted(opt,"measure_forest"))
+    out.push_back(measure(opt,"measure_forest",config,nwin,[&](){
+      float c = 0;
+      for (int i=0;i<nwin;i++)
+        c += classifier.measure_forest(ferns[i]);
+      sink = c;
+    }));
+  //100 detections scattered around the object (the detector keeps at most 100)
+  if (wanted(opt,"clusterConf")){
+      RNG rng(7);
+      vector<BoundingBox> dbb;
+      vector<float> dconf;
+      for (int i=0;i<100;i++){
+          int d = max(2,box.width/2);
+          BoundingBox bb(Rect(box.x+rng.uniform(-d,d),box.y+rng.uniform(-d,d),box.width,box.height));
+          if (i%4==0)
+            bb.x = rng.uniform(0,max(1,frame.cols-box.width));
+          dbb.push_back(bb);
+          dconf.push_back(rng.uniform(0.f,1.f));
+      }
+      vector<BoundingBox> cbb;
+      vector<float> cconf;
+      out.push_back(measure(opt,"clusterConf",config,1,[&](){
+        tld.clusterConf(dbb,dconf,cbb,cconf);
+        sink = cconf.size();
+      }));
+  }
+  //Tracking: 10x10 points in the box from frame to next
+  if (wanted(opt,"trackf2f")){
+      LKTracker tracker;
+      vector<Point2f> grid_points;
+      tld.bbPoints(grid_points,target);
+      vector<Point2f> points1, points2;
+      out.push_back(measure(opt,"trackf2f",config,1,[&](){
+        points1 = grid_points;
+        points2.clear();
+        sink = tracker.trackf2f(frame,next,points1,points2);
+      }));
+  }
+}
+
+//int8 dot product with every kernel variant this CPU runs, NN patch sizes
+void runIsaKernels(const MicroOptions& opt,vector<KernelStats>& out){
+  if (!wanted(opt,"dotInt8"))
+    return;
+  RNG rng(13);
+  const int strides[] = {QuantizedPatches::strideFor(15*15),QuantizedPatches::strideFor(25*25)};
+  int n = 256;
+  for (int k=0;k<2;k++){
+      int stride = strides[k];
+      vector<int8_t> a((size_t)n*stride), q(stride);
+      for (size_t i=0;i<a.size();i++)
+        a[i] = (int8_t)rng.uniform(-127,128);
+      for (int i=0;i<stride;i++)
+        q[i] = (int8_t)rng.uniform(-127,128);
+      for (int isa=0;isa<=cpuIsaDetected();isa++){
+          ostringstream config;
+          config << "stride" << stride << "/" << cpuIsaName(isa);
+          out.push_back(measure(opt,"dotInt8",config.str(),n,[&](){
+            int s = 0;
+            for (int i=0;i<n;i++)
+              s += dotInt8(isa,&a[(size_t)i*stride],&q[0],stride);
+            sink = s;
+          }));
+      }
+  }
+}
+
+//NN classifier at several model sizes (frame independent)
+void runNNKernels(const MicroOptions& opt,const FileNode& params,const string& source,const Mat& frame,const Rect& box,vector<KernelStats>& out){
+  if (!wanted(opt,"NNConf"))
+    return;
+  TLD tld(params);
+  FerNNClassifier classifier;
+  classifier.read(params);
+  vector<BoundingBox> windows = slidingWindows(frame.size(),box.size());
+  if (windows.empty())
+    return;
+  RNG rng(11);
+  vector<Mat> patterns(512);
+  Scalar mean, stdev;
+  for (size_t i=0;i<patterns.size();i++)
+    tld.getPattern(frame(windows[rng.uniform(0,(int)windows.size())]),patterns[i],mean,stdev);
+  const int sizes[] = {10,50,200};
+  for (int k=0;k<6;k++){
+      //float examples, then int8 examples (dotInt8Kernel)
+      int n = sizes[k%3];
+      bool q = k>=3;
+      classifier.setQuantized(false);
+      classifier.pEx.assign(patterns.begin(),patterns.begin()+n);
+      classifier.nEx.assign(patterns.begin()+n,patterns.begin()+2*n);
+      classifier.setQuantized(q);
+      vector<int> isin;
+      float rsconf, csconf;
+      int nq = 64;
+      ostringstream config;
+      config << source << "/pEx" << n << "/nEx" << n;
+      if (q)
+        config << "/int8-" << dotInt8Kernel();
+      out.push_back(measure(opt,"NNConf",config.str(),nq,[&](){
+        for (int i=0;i<nq;i++)
+          classifier.NNConf(patterns[patterns.size()-1-i],isin,rsconf,csconf);
+        sink = rsconf;
+      }));
+  }
+}
+
+void writeReport(const MicroOptions& opt,const vector<KernelStats>& stats){
+  FILE* file = fopen(opt.output.c_str(),"w");
+  if (!file){
+      printf("Could not write %s\n",opt.output.c_str());
+      return;
+  }
+  JsonWriter json(file);
+  json.beginObject();
+  json.member("samples",opt.samples);
+  json.member("min_sample_ms",opt.min_sample_ms);
+  json.member("isa",cpuIsaName(cpuIsa()));
+  json.member("isa_detected",cpuIsaName(cpuIsaDetected()));
+  json.key("kernels").beginArray();
+  for (size_t i=0;i<stats.size();i++){
+      const KernelStats& k = stats[i];
+      json.beginObject();
+      json.member("id",k.name+" "+k.config);
+      json.member("name",k.name);
+      json.member("config",k.config);
+      json.member("ops",k.ops);
+      json.member("calls",k.calls);
+      json.member("median_ns",k.median);
+      json.member("mad_ns",k.mad);
+      json.member("min_ns",k.min);
+      json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  fclose(file);
+  printf("Report written to %s\n",opt.output.c_str());
+}
+
+//Reads the id/median/mad members of a report written by writeReport
+bool readReport(const string& path,vector<string>& ids,map<string,pair<double,double> >& values){
+  ifstream file(path.c_str());
+  if (!file.is_open())
+    return false;
+  string line, id;
+  while (getline(file,line)){
+      size_t colon = line.find("\": ");
+      size_t quote = line.find('"');
+      if (colon==string::npos || quote==string::npos)
+        continue;
+      string key = line.substr(quote+1,colon-quote-1);
+      string value = line.substr(colon+3);
+      if (!value.empty() && value[value.size()-1]==',')
+        value.erase(value.size()-1);
+      if (key=="id"){
+          id = value.substr(1,value.size()-2);
+          ids.push_back(id);
+      }
+      else if (key=="median_ns")
+        values[id].first = atof(value.c_str());
+      else if (key=="mad_ns")
+        values[id].second = atof(value.c_str());
+  }
+  return true;
+}
+
+//Side by side, a change counts when it is larger than 3 MADs of both runs
+int compareReports(const string& a,const string& b){
+  vector<string> ids_a, ids_b;
+  map<string,pair<double,double> > va, vb;
+  if (!readReport(a,ids_a,va) || !readReport(b,ids_b,vb)){
+      printf("Could not read %s or %s\n",a.c_str(),b.c_str());
+      return 1;
+  }
+  printf("%-40s %12s %12s %8s\n","kernel","base ns/op","new ns/op","speedup");
+  for (size_t i=0;i<ids_a.size();i++){
+      const string& id = ids_a[i];
+      if (vb.find(id)==vb.end())
+        continue;
+      double ma = va[id].first, mb = vb[id].first;
+      double noise = 3*(va[id].second+vb[id].second);
+      const char* verdict = fabs(ma-mb)<=noise ? "~" : (mb<ma ? "faster" : "slower");
+      printf("%-40s %12.1f %12.1f %7.2fx %s\n",id.c_str(),ma,mb,mb>0 ? ma/mb : 0.0,verdict);
+  }
+  return 0;
+}
+
+void print_help(char** argv){
+  printf("use:\n     %s -p /path/parameters.yml\n",argv[0]);
+  printf("-s    dataset video (first two frames)\n-b    bounding box file for -s\n-k    only kernels containing this name\n-r    samples per kernel (default 21)\n-t    minimum sample time in ms (default 2)\n-cpu  pin to a core\n-isa  kernel instruction set (scalar, sse2, sse4.1, avx2, avx512)\n-o    JSON report (default microbench.json)\n-compare base.json new.json\n");
+}
+
+bool read_options(int argc,char** argv,MicroOptions& opt){
+  for (int i=1;i<argc;i++){
+      bool has_value = i+1<argc;
+      if (strcmp(argv[i],"-p")==0 && has_value)
+        opt.params = argv[++i];
+      else if (strcmp(argv[i],"-s")==0 && has_value)
+        opt.video = argv[++i];
+      else if (strcmp(argv[i],"-b")==0 && has_value)
+        opt.box_file = argv[++i];
+      else if (strcmp(argv[i],"-k")==0 && has_value)
+        opt.filter = argv[++i];
+      else if (strcmp(argv[i],"-r")==0 && has_value)
+        opt.samples = max(1,atoi(argv[++i]));
+      else if (strcmp(argv[i],"-t")==0 && has_value)
+        opt.min_sample_ms = atof(argv[++i]);
+      else if (strcmp(argv[i],"-cpu")==0 && has_value)
+        opt.cpu = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-isa")==0 && has_value)
+        opt.isa = argv[++i];
+      else if (strcmp(argv[i],"-o")==0 && has_value)
+        opt.output = argv[++i];
+      else if (strcmp(argv[i],"-compare")==0 && i+2<argc){
+          opt.compare[0] = argv[++i];
+          opt.compare[1] = argv[++i];
+      }
+      else {
+          print_help(argv);
+          return false;
+      }
+  }
+  if (opt.params.empty() && opt.compare[0].empty()){
+      print_help(argv);
+      return false;
+  }
+  return true;
+}
+
+int main(int argc,char* argv[]){
+  MicroOptions opt;
+  if (!read_options(argc,argv,opt))
+    return 1;
+  if (!opt.compare[0].empty())
+    return compareReports(opt.compare[0],opt.compare[1]);
+  if (opt.cpu>=0){
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(opt.cpu,&set);
+      if (sched_setaffinity(0,sizeof(set),&set)!=0)
+        printf("Could not pin to cpu %d\n",opt.cpu);
+  }
+  if (!opt.isa.empty() && !setCpuIsa(opt.isa.c_str())){
+      printf("Instruction set %s is not available, this CPU has %s\n",opt.isa.c_str(),cpuIsaName(cpuIsaDetected()));
+      return 1;
+  }
+  printf("Kernels: %s (detected %s)\n",cpuIsaName(cpuIsa()),cpuIsaName(cpuIsaDetected()));
+  FileStorage fs(opt.params,FileStorage::READ);
+  if (!fs.isOpened()){
+      printf("Could not read parameters %s\n",opt.params.c_str());
+      return 1;
+  }
+  FileNode params = fs.getFirstTopLevelNode();
+  //Resolutions, the object is 1/6 of the frame width like in the datasets
+  const Size sizes[] = {Size(320,240),Size(640,480),Size(1280,720)};
+  vector<KernelStats> stats;
+  for (int r=0;r<3;r++){
+      Size size = sizes[r];
+      Rect box(size.width*5/12,size.height*5/12,size.width/6,size.height/6);
+      Mat frame = syntheticFrame(size,box,1);
+      Mat next;
+      Mat shift = Mat::eye(2,3,CV_64F);  //2 px right, 1 px down
+      shift.at<double>(0,2) = 2;
+      shift.at<double>(1,2) = 1;
+      warpAffine(frame,next,shift,size,INTER_LINEAR,BORDER_REFLECT);
+      ostringstream config;
+      config << "synthetic/" << size.width << "x" << size.height;
+      runFrameKernels(opt,params,config.str(),frame,next,box,stats);
+      if (r==0)
+        runNNKernels(opt,params,"synthetic",frame,box,stats);
+  }
+  runIsaKernels(opt,stats);
+  if (!opt.video.empty()){
+      VideoCapture capture(opt.video);
+      Mat color, first, second;
+      if (capture.read(color))
+        cvtColor(color,first,CV_RGB2GRAY);
+      if (capture.read(color))
+        cvtColor(color,second,CV_RGB2GRAY);
+      if (first.empty() || second.empty()){
+          printf("Could not read two frames from %s\n",opt.video.c_str());
+          return 1;
+      }
+      Rect box(first.cols*5/12,first.rows*5/12,first.cols/6,first.rows/6);
+      if (!opt.box_file.empty()){
+          ifstream bb_file(opt.box_file.c_str());
+          int x1,y1,x2,y2;
+          char c;
+          if (bb_file >> x1 >> c >> y1 >> c >> x2 >> c >> y2)
+            box = Rect(x1,y1,x2-x1,y2-y1);
+      }
+      for (int r=0;r<3;r++){
+          Size size = sizes[r];
+          double sx = (double)size.width/first.cols, sy = (double)size.height/first.rows;
+          Mat frame, next;
+          resize(first,frame,size);
+          resize(second,next,size);
+          Rect scaled = scaleRect(box,sx,sy) & Rect(0,0,size.width,size.height);
+          ostringstream config;
+          config << "video/" << size.width << "x" << size.height;
+          runFrameKernels(opt,params,config.str(),frame,next,scaled,stats);
+          if (r==0)
+            runNNKernels(opt,params,"video",frame,scaled,stats);
+      }
+  }
+  writeReport(opt,stats);
+  return 0;
+}
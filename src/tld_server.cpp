@@ -0,0 +1,80 @@
+/*
+ * tld_server.cpp
+ *
+ * Tracks the objects of many video streams in one process (see
+ * TrackingServer.h). Streams are listed in a text file:
+ *   # name   source                    x   y   width height [priority]
+ *   car      ../datasets/06_car/car.mpg 142 125 90  60
+ *   cam2     raw:640x480:/tmp/cam2.fifo 300 200 40  80     2
+ */
+#include <opencv2/opencv.hpp>
+#include <TrackingServer.h>
+#include <tld_log.h>
+#include <stdio.h>
+#include <string.h>
+using namespace cv;
+using namespace std;
+
+void print_help(char** argv){
+  printf("use:\n     %s -p /path/parameters.yml -streams streams.txt\n",argv[0]);
+  printf("-w    worker threads (default: hardware threads)\n-q    frames queued per stream before the oldest is dropped (default 4)\n-age  drop frames older than this many ms when newer ones wait\n-fps  pace video files at this frame rate\n-tl   track and learn\n-o    write <name>.txt results to this directory\n");
+}
+
+int main(int argc,char* argv[]){
+  string params, list;
+  ServerOptions opt;
+  for (int i=1;i<argc;i++){
+      bool has_value = i+1<argc;
+      if (strcmp(argv[i],"-p")==0 && has_value)
+        params = argv[++i];
+      else if (strcmp(argv[i],"-streams")==0 && has_value)
+        list = argv[++i];
+      else if (strcmp(argv[i],"-w")==0 && has_value)
+        opt.workers = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-q")==0 && has_value)
+        opt.max_queue = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-age")==0 && has_value)
+        opt.max_age_ms = atof(argv[++i]);
+      else if (strcmp(argv[i],"-fps")==0 && has_value)
+        opt.fps = atof(argv[++i]);
+      else if (strcmp(argv[i],"-o")==0 && has_value)
+        opt.output = argv[++i];
+      else if (strcmp(argv[i],"-tl")==0)
+        opt.learning = true;
+      else {
+          print_help(argv);
+          return 1;
+      }
+  }
+  if (params.empty() || list.empty()){
+      print_help(argv);
+      return 1;
+  }
+  FileStorage fs(params,FileStorage::READ);
+  if (!fs.isOpened()){
+      printf("Could not read parameters %s\n",params.c_str());
+      return 1;
+  }
+  vector<StreamSpec> specs;
+  if (!readStreamList(list,specs) || specs.empty()){
+      printf("No streams in %s\n",list.c_str());
+      return 1;
+  }
+  TrackingServer server(fs.getFirstTopLevelNode(),opt);
+  for (size_t i=0;i<specs.size();i++)
+    server.addStream(specs[i]);
+  int64 t0 = getTickCount();
+  server.run();
+  double seconds = (getTickCount()-t0)/getTickFrequency();
+  tld_log_flush();
+  printf("%-16s %8s %8s %8s %8s %10s %10s\n","stream","frames","dropped","found","fps","latency","max");
+  int total = 0;
+  for (int s=0;s<server.numStreams();s++){
+      StreamStats st = server.stats(s);
+      total += st.processed;
+      printf("%-16s %8d %8d %8d %8.1f %8.1fms %8.1fms\n",server.spec(s).name.c_str(),st.processed,st.dropped,st.found,
+          st.processed/seconds,st.processed>0 ? st.latency_ms/st.processed : 0.0,st.max_latency_ms);
+  }
+  printf("%d streams, %d frames in %.1f s (%.1f fps)\n",server.numStreams(),total,seconds,total/seconds);
+  return 0;
+}
@@ -0,0 +1,485 @@
+/*
+ * tld_tune.cpp
+ *
+ * Offline search of the parameters that set the cost of a frame. Every
+ * configuration (a base parameters.yml with some values replaced) runs over
+ * the datasets/ sequences, several runs at a time, and is scored by fps and
+ * recall against gt.txt. The configurations no other one beats on both
+ * (the Pareto front) are reported and written as parameter files.
+ * Runs share the machine, so use at most one worker per physical core for
+ * fps figures that compare with a single run.
+ */
+#include <opencv2/opencv.hpp>
+#include <TLDSession.h>
+#include <FrameSource.h>
+#include <JsonWriter.h>
+#include <tld_eval.h>
+#include <tld_log.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+using namespace cv;
+using namespace std;
+
+struct TuneOptions {
+  TuneOptions():datasets("../datasets"),output("tune"),configs(32),max_frames(0),workers(0),seed(1),
+      tl(false),cache(false),all(false){}
+  string params;
+  string datasets;
+  string output;             //report and parameter files directory
+  vector<string> sequences;  //empty: every sequence with a video
+  vector<string> sets;       //name=v1,v2,... replacing a parameter's values
+  int configs;               //sampled configurations (with -all: every one)
+  int max_frames;            //0: whole sequence
+  int workers;               //0: hardware threads
+  uint64 seed;
+  bool tl;
+  bool cache;
+  bool all;
+};
+
+//A parameter and the values tried, as written in the parameter file
+struct TuneParam {
+  string name;
+  vector<string> values;
+};
+
+struct Sequence {
+  string name;
+  string video;
+  Rect box;
+  vector<EvalBox> gt;
+};
+
+//One configuration on one sequence
+struct TuneRun {
+  TuneRun():frames(0),process_ms(0),failed(false){}
+  int frames;                //processed frames, init excluded
+  double process_ms;
+  bool failed;
+  vector<EvalBox> boxes;
+};
+
+struct TuneConfig {
+  vector<int> choice;        //value index per parameter, -1: base value
+  string yaml;
+  vector<TuneRun> runs;      //per sequence
+  double fps;
+  EvalScore score;
+  bool pareto;
+};
+
+void print_help(char** argv){
+  printf("use:\n     %s -p /path/parameters.yml\n",argv[0]);
+  printf("-d    datasets directory (default ../datasets)\n-seq  sequence to run (repeatable, default all)\n-o    output directory (default tune)\n"
+         "-n    configurations sampled (default 32)\n-all  every configuration of the space\n-set  name=v1,v2,... values tried for a parameter, name= keeps the base value (repeatable)\n"
+         "-f    maximum frames per sequence\n-w    concurrent runs (default: hardware threads)\n-s    random seed\n-tl   track and learn\n-c    cache decoded frames next to the videos\n");
+}
+
+bool read_options(int argc,char** argv,TuneOptions& opt){
+  for (int i=1;i<argc;i++){
+      bool has_value = i+1<argc;
+      if (strcmp(argv[i],"-p")==0 && has_value)
+        opt.params = argv[++i];
+      else if (strcmp(argv[i],"-d")==0 && has_value)
+        opt.datasets = argv[++i];
+      else if (strcmp(argv[i],"-seq")==0 && has_value)
+        opt.sequences.push_back(argv[++i]);
+      else if (strcmp(argv[i],"-o")==0 && has_value)
+        opt.output = argv[++i];
+      else if (strcmp(argv[i],"-n")==0 && has_value)
+        opt.configs = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-set")==0 && has_value)
+        opt.sets.push_back(argv[++i]);
+      else if (strcmp(argv[i],"-f")==0 && has_value)
+        opt.max_frames = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-w")==0 && has_value)
+        opt.workers = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-s")==0 && has_value)
+        opt.seed = atoi(argv[++i]);
+      else if (strcmp(argv[i],"-all")==0)
+        opt.all = true;
+      else if (strcmp(argv[i],"-tl")==0)
+        opt.tl = true;
+      else if (strcmp(argv[i],"-c")==0)
+        opt.cache = true;
+      else {
+          print_help(argv);
+          return false;
+      }
+  }
+  if (opt.params.empty()){
+      print_help(argv);
+      return false;
+  }
+  return true;
+}
+
+static void addParam(vector<TuneParam>& space,const string& name,const string& values){
+  TuneParam p;
+  p.name = name;
+  istringstream list(values);
+  string v;
+  while (getline(list,v,','))
+    if (!v.empty())
+      p.values.push_back(v);
+  //No values: the base file's value is kept
+  for (size_t i=0;i<space.size();i++){
+      if (space[i].name==name){
+          if (p.values.empty())
+            space.erase(space.begin()+i);
+          else
+            space[i] = p;
+          return;
+      }
+  }
+  if (!p.values.empty())
+    space.push_back(p);
+}
+
+//Parameters driving the cost of a frame: detector size, grid density and
+//the number of examples generated by learning
+static void defaultSpace(vector<TuneParam>& space){
+  addParam(space,"num_trees","6,8,10,12");
+  addParam(space,"num_features","8,10,13");
+  addParam(space,"min_win","15,20,25");
+  addParam(space,"grid_shift","0.1,0.15,0.2");
+  addParam(space,"scale_step","1.2,1.3,1.44");
+  addParam(space,"num_scales","11,15,21");
+  addParam(space,"num_warps_init","10,20");
+  addParam(space,"num_warps_update","5,10");
+  addParam(space,"num_closest_init","5,10");
+  addParam(space,"num_closest_update","5,10");
+  addParam(space,"num_patches","50,100");
+}
+
+static int paramIndex(const vector<TuneParam>& space,const string& name){
+  for (size_t i=0;i<space.size();i++){
+      if (space[i].name==name)
+        return i;
+  }
+  return -1;
+}
+
+//Key/value lines of a flat parameters.yml ("   key: value")
+static bool readParamLines(const string& path,vector<string>& lines,map<string,string>& values){
+  ifstream file(path.c_str());
+  if (!file.is_open())
+    return false;
+  string line;
+  while (getline(file,line)){
+      lines.push_back(line);
+      size_t colon = line.find(':');
+      size_t start = line.find_first_not_of(" \t");
+      if (colon==string::npos || start==string::npos || start==0 || line[start]=='#')
+        continue;
+      string value = line.substr(colon+1);
+      value.erase(0,value.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t\r")+1);
+      values[line.substr(start,colon-start)] = value;
+  }
+  return true;
+}
+
+//The base file with the chosen values replaced, missing keys appended
+static string configYaml(const vector<string>& lines,const vector<TuneParam>& space,const vector<int>& choice){
+  vector<bool> written(space.size(),false);
+  ostringstream yaml;
+  for (size_t l=0;l<lines.size();l++){
+      const string& line = lines[l];
+      size_t colon = line.find(':');
+      size_t start = line.find_first_not_of(" \t");
+      int p = -1;
+      if (colon!=string::npos && start!=string::npos && start>0)
+        p = paramIndex(space,line.substr(start,colon-start));
+      if (p>=0 && choice[p]>=0){
+          yaml << line.substr(0,colon+1) << " " << space[p].values[choice[p]] << "\n";
+          written[p] = true;
+      }
+      else if (line.find_first_not_of(" \t\r")!=string::npos)
+        yaml << line << "\n";
+  }
+  for (size_t p=0;p<space.size();p++){
+      if (!written[p] && choice[p]>=0)
+        yaml << "   " << space[p].name << ": " << space[p].values[choice[p]] << "\n";
+  }
+  return yaml.str();
+}
+
+//Configuration 0 is the base file, then every one (-all) or opt.configs random ones
+static void chooseConfigs(const TuneOptions& opt,const vector<TuneParam>& space,vector<vector<int> >& choices){
+  choices.push_back(vector<int>(space.size(),-1));
+  if (opt.all){
+      vector<int> c(space.size(),0);
+      while (true){
+          choices.push_back(c);
+          size_t p = 0;
+          while (p<space.size() && ++c[p]==(int)space[p].values.size())
+            c[p++] = 0;
+          if (p==space.size())
+            break;
+      }
+      return;
+  }
+  RNG rng(opt.seed);
+  set<vector<int> > seen;
+  for (int attempt=0;(int)choices.size()<=opt.configs && attempt<opt.configs*100;attempt++){
+      vector<int> c(space.size());
+      for (size_t p=0;p<space.size();p++)
+        c[p] = rng.uniform(0,(int)space[p].values.size());
+      if (seen.insert(c).second)
+        choices.push_back(c);
+  }
+}
+
+static bool loadSequence(const string& dir,Sequence& seq){
+  vector<EvalBox> init;
+  seq.video = findVideo(dir);
+  if (seq.video.empty() || !readBoxes(dir+"/gt.txt",seq.gt) || !readBoxes(dir+"/init.txt",init) || init.empty())
+    return false;
+  //Same conversion as run_tld's readBB
+  seq.box = Rect((int)init[0].x1,(int)init[0].y1,(int)init[0].x2-(int)init[0].x1,(int)init[0].y2-(int)init[0].y1);
+  return true;
+}
+
+void runSequence(const TuneOptions& opt,const Sequence& seq,const string& yaml,TuneRun& run){
+  FileStorage fs(yaml,FileStorage::READ+FileStorage::MEMORY);
+  FrameSource source;
+  Mat gray;
+  if (!fs.isOpened() || !source.open(seq.video,opt.cache ? seq.video+".frames" : "") || !source.read(gray)){
+      run.failed = true;
+      return;
+  }
+  TLDSession session(fs.getFirstTopLevelNode());
+  session.setLearning(opt.tl);
+  session.profiler().setEnabled(false);
+  run.boxes.push_back(toEvalBox(session.init(gray,seq.box,true).record()));
+  while (opt.max_frames<=0 || (int)run.boxes.size()<opt.max_frames){
+      if (!source.read(gray))
+        break;
+      int64 t0 = getTickCount();
+      const TLDResult& result = session.process(gray,true);
+      run.process_ms += (getTickCount()-t0)*1000.0/getTickFrequency();
+      run.boxes.push_back(toEvalBox(result.record()));
+      run.frames++;
+  }
+}
+
+//Frames per second over every sequence, recall against gt.txt over every frame
+static void scoreConfig(const vector<Sequence>& seqs,TuneConfig& c){
+  vector<EvalBox> boxes, truth;
+  int frames = 0;
+  double ms = 0;
+  EvalBox none = {false,0,0,0,0};
+  for (size_t s=0;s<seqs.size();s++){
+      const TuneRun& run = c.runs[s];
+      const vector<EvalBox>& gt = seqs[s].gt;
+      frames += run.frames;
+      ms += run.process_ms;
+      //A failed run counts as missing the object in every frame
+      size_t n = run.failed ? gt.size() : min(run.boxes.size(),gt.size());
+      for (size_t i=0;i<n;i++){
+          boxes.push_back(i<run.boxes.size() ? run.boxes[i] : none);
+          truth.push_back(gt[i]);
+      }
+  }
+  c.fps = ms>0 ? frames*1000.0/ms : 0;
+  c.score = evaluate(boxes,truth);
+}
+
+struct FpsComparator{
+  FpsComparator(const vector<TuneConfig>& _c):c(_c){}
+  const vector<TuneConfig>& c;
+  bool operator()(int a,int b){
+    return c[a].fps>c[b].fps || (c[a].fps==c[b].fps && c[a].score.recall>c[b].score.recall);
+  }
+};
+
+//Configurations no other one beats on both fps and recall, fastest first
+static vector<int> paretoFront(vector<TuneConfig>& configs){
+  vector<int> order(configs.size());
+  for (size_t i=0;i<order.size();i++)
+    order[i] = i;
+  sort(order.begin(),order.end(),FpsComparator(configs));
+  vector<int> front;
+  double best_recall = -1;
+  for (size_t i=0;i<order.size();i++){
+      TuneConfig& c = configs[order[i]];
+      c.pareto = c.score.recall>best_recall;
+      if (c.pareto){
+          best_recall = c.score.recall;
+          front.push_back(order[i]);
+      }
+  }
+  return front;
+}
+
+static void writeReport(const TuneOptions& opt,const string& path,const vector<TuneParam>& space,const vector<Sequence>& seqs,
+    const vector<TuneConfig>& configs,const vector<int>& front){
+  FILE* file = fopen(path.c_str(),"w");
+  if (!file){
+      printf("Could not write %s\n",path.c_str());
+      return;
+  }
+  JsonWriter json(file);
+  json.beginObject();
+  json.member("params",opt.params);
+  json.member("learning",opt.tl);
+  json.member("max_frames",opt.max_frames);
+  json.key("sequences").beginArray();
+  for (size_t s=0;s<seqs.size();s++)
+    json.value(seqs[s].name);
+  json.endArray();
+  json.key("configs").beginArray();
+  for (size_t i=0;i<configs.size();i++){
+      const TuneConfig& c = configs[i];
+      json.beginObject();
+      json.member("id",(int)i);
+      json.key("values").beginObject();
+      for (size_t p=0;p<space.size();p++){
+          if (c.choice[p]>=0)
+            json.member(space[p].name,space[p].values[c.choice[p]]);
+      }
+      json.endObject();
+      json.member("fps",c.fps);
+      json.member("recall",c.score.recall);
+      json.member("precision",c.score.precision);
+      json.member("f_measure",c.score.f_measure);
+      json.member("pareto",c.pareto);
+      json.endObject();
+  }
+  json.endArray();
+  json.key("pareto").beginArray();
+  for (size_t i=0;i<front.size();i++)
+    json.value(front[i]);
+  json.endArray();
+  json.endObject();
+  fclose(file);
+}
+
+int main(int argc,char* argv[]){
+  TuneOptions opt;
+  if (!read_options(argc,argv,opt))
+    return 1;
+  vector<string> lines;
+  map<string,string> base;
+  if (!readParamLines(opt.params,lines,base)){
+      printf("Could not read parameters %s\n",opt.params.c_str());
+      return 1;
+  }
+  vector<TuneParam> space;
+  defaultSpace(space);
+  for (size_t i=0;i<opt.sets.size();i++){
+      size_t eq = opt.sets[i].find('=');
+      if (eq==string::npos){
+          printf("-set expects name=v1,v2,...\n");
+          return 1;
+      }
+      addParam(space,opt.sets[i].substr(0,eq),opt.sets[i].substr(eq+1));
+  }
+  vector<string> names = opt.sequences.empty() ? listDirectory(opt.datasets) : opt.sequences;
+  vector<Sequence> seqs;
+  int min_side = INT_MAX;
+  for (size_t i=0;i<names.size();i++){
+      string dir = opt.datasets+"/"+names[i];
+      Sequence seq;
+      seq.name = names[i];
+      if (!isDirectory(dir) || !loadSequence(dir,seq)){
+          printf("%-16s skipped\n",names[i].c_str());
+          continue;
+      }
+      min_side = min(min_side,min(seq.box.width,seq.box.height));
+      seqs.push_back(seq);
+  }
+  if (seqs.empty()){
+      printf("No sequences in %s\n",opt.datasets.c_str());
+      return 1;
+  }
+  //The object has to be one of the grid's scales
+  int mw = paramIndex(space,"min_win");
+  if (mw>=0){
+      vector<string> kept;
+      for (size_t v=0;v<space[mw].values.size();v++){
+          if (atoi(space[mw].values[v].c_str())<=min_side)
+            kept.push_back(space[mw].values[v]);
+      }
+      if (kept.size()<space[mw].values.size())
+        printf("min_win limited to %d, the smallest initial box side\n",min_side);
+      if (kept.empty())
+        space.erase(space.begin()+mw);
+      else
+        space[mw].values = kept;
+  }
+  //The first pass writes the frame caches, later runs only read them
+  if (opt.cache){
+      for (size_t s=0;s<seqs.size();s++){
+          FrameSource source;
+          Mat gray;
+          if (source.open(seqs[s].video,seqs[s].video+".frames"))
+            while (!source.fromCache() && source.read(gray)){}
+      }
+  }
+  vector<vector<int> > choices;
+  chooseConfigs(opt,space,choices);
+  vector<TuneConfig> configs(choices.size());
+  for (size_t i=0;i<configs.size();i++){
+      configs[i].choice = choices[i];
+      configs[i].yaml = configYaml(lines,space,choices[i]);
+      configs[i].runs.resize(seqs.size());
+      configs[i].pareto = false;
+  }
+  int workers = opt.workers>0 ? opt.workers : max(1u,thread::hardware_concurrency());
+  int jobs = configs.size()*seqs.size();
+  printf("%d configurations x %d sequences on %d workers\n",(int)configs.size(),(int)seqs.size(),workers);
+  //Jobs are taken configuration by configuration, so each one finishes early
+  atomic<int> next_job(0);
+  vector<int> remaining(configs.size(),seqs.size());
+  mutex mtx;
+  vector<thread> pool;
+  for (int w=0;w<workers;w++){
+      pool.push_back(thread([&](){
+        int j;
+        while ((j = next_job++)<jobs){
+            int c = j/seqs.size(), s = j%seqs.size();
+            runSequence(opt,seqs[s],configs[c].yaml,configs[c].runs[s]);
+            lock_guard<mutex> lock(mtx);
+            if (--remaining[c]==0){
+                scoreConfig(seqs,configs[c]);
+                printf("config %4d  %7.1f fps  recall %.3f\n",c,configs[c].fps,configs[c].score.recall);
+            }
+        }
+      }));
+  }
+  for (size_t w=0;w<pool.size();w++)
+    pool[w].join();
+  tld_log_flush();
+  vector<int> front = paretoFront(configs);
+  mkdir(opt.output.c_str(),0755);
+  printf("Pareto front (fps vs recall):\n");
+  for (size_t i=0;i<front.size();i++){
+      const TuneConfig& c = configs[front[i]];
+      char name[64];
+      sprintf(name,"pareto_%02d.yml",(int)i);
+      string path = opt.output+"/"+name;
+      ofstream file(path.c_str());
+      file << c.yaml;
+      printf("%-16s %7.1f fps  recall %.3f  precision %.3f ",name,c.fps,c.score.recall,c.score.precision);
+      for (size_t p=0;p<space.size();p++){
+          if (c.choice[p]>=0)
+            printf(" %s=%s",space[p].name.c_str(),space[p].values[c.choice[p]].c_str());
+      }
+      printf("%s\n",front[i]==0 ? " (base)" : "");
+  }
+  writeReport(opt,opt.output+"/tune.json",space,seqs,configs,front);
+  printf("Report written to %s/tune.json\n",opt.output.c_str());
+  return 0;
+}
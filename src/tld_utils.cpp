@@ -20,6 +20,21 @@ Mat createMask(const Mat& image, CvRect box){
   return mask;
 }
 
+float bbOverlap(const Rect& box1,const Rect& box2){
+  if (box1.x > box2.x+box2.width) { return 0.0; }
+  if (box1.y > box2.y+box2.height) { return 0.0; }
+  if (box1.x+box1.width < box2.x) { return 0.0; }
+  if (box1.y+box1.height < box2.y) { return 0.0; }
+
+  float colInt =  min(box1.x+box1.width,box2.x+box2.width) - max(box1.x, box2.x);
+  float rowInt =  min(box1.y+box1.height,box2.y+box2.height) - max(box1.y,box2.y);
+
+  float intersection = colInt * rowInt;
+  float area1 = box1.width*box1.height;
+  float area2 = box2.width*box2.height;
+  return intersection / (area1 + area2 - intersection);
+}
+
 float median(vector<float> v)
 {
     int n = floor(v.size() / 2);